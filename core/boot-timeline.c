@@ -0,0 +1,122 @@
+/* Copyright 2013-2014 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <skiboot.h>
+#include <boot-timeline.h>
+#include <cpu.h>
+#include <device.h>
+#include <lock.h>
+#include <opal.h>
+#include <timebase.h>
+
+static struct boot_timeline boot_timeline = {
+	.eye_catcher	= "BOOTTIME",
+	.version	= BOOT_TIMELINE_VERSION,
+	.entry_size	= sizeof(struct boot_event),
+	.max_entries	= BOOT_TIMELINE_ENTRIES,
+	.tb_hz		= tb_hz,
+};
+static struct lock boot_timeline_lock = LOCK_UNLOCKED;
+
+int boot_timeline_start(const char *name, u32 id)
+{
+	struct boot_event *e;
+	unsigned int n;
+
+	lock(&boot_timeline_lock);
+	n = boot_timeline.num_entries;
+	if (n < BOOT_TIMELINE_ENTRIES)
+		boot_timeline.num_entries = n + 1;
+	unlock(&boot_timeline_lock);
+
+	if (n >= BOOT_TIMELINE_ENTRIES)
+		return -1;
+
+	e = &boot_timeline.events[n];
+	strncpy(e->name, name, BOOT_EVENT_NAME_LEN - 1);
+	e->id = id;
+	e->pir = this_cpu()->pir;
+	e->start_tb = mftb();
+	return n;
+}
+
+void boot_timeline_end(int ev)
+{
+	if (ev < 0 || ev >= BOOT_TIMELINE_ENTRIES)
+		return;
+	boot_timeline.events[ev].end_tb = mftb();
+}
+
+/*
+ * Called around the ChipTOD sync, when only the boot CPU records.
+ * The time spent syncing is lost, old_tb and new_tb are taken as
+ * the same instant.
+ */
+void boot_timeline_tb_sync(u64 old_tb, u64 new_tb)
+{
+	struct boot_event *e;
+	unsigned int i;
+
+	for (i = 0; i < boot_timeline.num_entries; i++) {
+		e = &boot_timeline.events[i];
+		e->start_tb += new_tb - old_tb;
+		if (e->end_tb)
+			e->end_tb += new_tb - old_tb;
+	}
+}
+
+void boot_timeline_add_properties(void)
+{
+	u64 addr = (u64)&boot_timeline;
+
+	dt_add_property_cells(opal_node, "ibm,opal-boot-timeline",
+			      hi32(addr), lo32(addr), sizeof(boot_timeline));
+}
+
+void boot_timeline_print(void)
+{
+	struct boot_event *e;
+	unsigned long first, last = 0, start, dur;
+	unsigned int i, n = boot_timeline.num_entries;
+
+	if (!n)
+		return;
+
+	/* Relative to the first event, which is the oldest */
+	first = boot_timeline.events[0].start_tb;
+	for (i = 0; i < n; i++) {
+		e = &boot_timeline.events[i];
+		if (e->end_tb && e->end_tb - first > last)
+			last = e->end_tb - first;
+	}
+
+	printf("BOOT: Timeline, %u events over %lu ms\n", n,
+	       tb_to_msecs(last));
+	printf("BOOT:   start ms    time us  cpu  event\n");
+	for (i = 0; i < n; i++) {
+		e = &boot_timeline.events[i];
+		start = tb_to_usecs(e->start_tb - first);
+		dur = e->end_tb ? tb_to_usecs(e->end_tb - e->start_tb) : 0;
+		if (e->id == BOOT_EVENT_NO_ID)
+			printf("BOOT: %5lu.%03lu %10lu %04x  %s\n",
+			       start / 1000, start % 1000, dur, e->pir,
+			       e->name);
+		else
+			printf("BOOT: %5lu.%03lu %10lu %04x  %s %u\n",
+			       start / 1000, start % 1000, dur, e->pir,
+			       e->name, e->id);
+	}
+}
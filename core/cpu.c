@@ -28,6 +28,7 @@
 #include <affinity.h>
 #include <chip.h>
 #include <timebase.h>
+#include <lock.h>
 #include <ccan/str/str.h>
 #include <ccan/container_of/container_of.h>
 
@@ -49,14 +50,39 @@ static struct lock reinit_lock = LOCK_UNLOCKED;
 
 unsigned long cpu_secondary_start __force_data = 0;
 
+/*
+ * A job is queued until the CPU running it moves it to done. A waiter
+ * which gives up moves it to abandoned instead, and then whoever loses
+ * that race frees the job.
+ */
+#define CPU_JOB_QUEUED		0
+#define CPU_JOB_DONE		1
+#define CPU_JOB_ABANDONED	2
+
 struct cpu_job {
-	struct list_node	link;
 	void			(*func)(void *data);
 	void			*data;
-	bool			complete;
+	unsigned long		state;
 	bool		        no_return;
+	bool			pooled;
+	bool			reported;	/* By cpu_job_group_wait_any() */
+	unsigned long		busy;	/* Pool slot taken */
+	struct cpu_thread	*cpu;
+	struct cpu_job		*group_next;
 };
 
+/*
+ * Jobs normally come from a static pool, claimed with a cmpxchg on
+ * their busy word, so queuing a job takes no lock and doesn't touch
+ * the heap. The pool covers a job on every thread of a large machine
+ * plus some, if it ever runs dry we fall back to the slab.
+ */
+#define CPU_JOB_POOL_SIZE	512
+
+static struct cpu_job cpu_job_pool[CPU_JOB_POOL_SIZE];
+static unsigned int cpu_job_pool_hint;
+static DEFINE_SLAB_CACHE(cpu_job_cache, struct cpu_job);
+
 /* attribute const as cpu_stacks is constant. */
 void __attrconst *cpu_stack_bottom(unsigned int pir)
 {
@@ -73,6 +99,101 @@ void __attrconst *cpu_stack_top(unsigned int pir)
 	return (void *)&cpu_stacks[pir] + STACK_SIZE - STACK_TOP_GAP;
 }
 
+static struct cpu_job *cpu_job_get(void)
+{
+	unsigned int i, n, start = cpu_job_pool_hint;
+	struct cpu_job *job;
+
+	for (i = 0; i < CPU_JOB_POOL_SIZE; i++) {
+		n = (start + i) % CPU_JOB_POOL_SIZE;
+		job = &cpu_job_pool[n];
+		if (job->busy || __lock_cmpxchg(&job->busy, 0, 1) != 0)
+			continue;
+		/* Just a hint, races don't matter */
+		cpu_job_pool_hint = n + 1;
+		sync();
+		job->pooled = true;
+		return job;
+	}
+
+	job = slab_zalloc(&cpu_job_cache);
+	if (job)
+		job->pooled = false;
+	return job;
+}
+
+static void cpu_job_put(struct cpu_job *job)
+{
+	if (!job->pooled) {
+		slab_free(&cpu_job_cache, job);
+		return;
+	}
+	lwsync();
+	job->busy = 0;
+}
+
+static bool cpu_job_push(struct cpu_thread *cpu, struct cpu_job *job)
+{
+	unsigned long head;
+
+	/* Reserve a slot, the caller gets to decide what to do if full */
+	do {
+		head = *(volatile unsigned long *)&cpu->job_head;
+		if (head - *(volatile unsigned long *)&cpu->job_tail
+		    >= CPU_JOB_RING_SIZE)
+			return false;
+	} while (__lock_cmpxchg(&cpu->job_head, head, head + 1) != head);
+
+	/* Publish the job, the consumer waits for the slot to fill */
+	lwsync();
+	cpu->job_ring[head % CPU_JOB_RING_SIZE] = job;
+	return true;
+}
+
+static struct cpu_job *cpu_job_pop(struct cpu_thread *cpu)
+{
+	struct cpu_job * volatile *slot;
+	struct cpu_job *job;
+	unsigned long tail = cpu->job_tail;
+
+	if (tail == *(volatile unsigned long *)&cpu->job_head)
+		return NULL;
+
+	/* The slot is reserved, wait for the producer to fill it */
+	slot = &cpu->job_ring[tail % CPU_JOB_RING_SIZE];
+	while (!(job = *slot))
+		smt_low();
+	smt_medium();
+
+	/* Free the slot before producers can see it */
+	*slot = NULL;
+	lwsync();
+	cpu->job_tail = tail + 1;
+	return job;
+}
+
+static bool cpu_job_pending(struct cpu_thread *cpu)
+{
+	return *(volatile unsigned long *)&cpu->job_head != cpu->job_tail;
+}
+
+/* One round of waiting for a job, keeping the mbox going */
+static void cpu_wait_poll(void)
+{
+	/*
+	 * Run whatever got queued to us meanwhile, the job we are
+	 * waiting for may itself be waiting on it.
+	 */
+	if (cpu_job_pending(this_cpu()))
+		cpu_process_jobs();
+
+	/* Handle mbox if master CPU */
+	if (this_cpu() == boot_cpu)
+		fsp_poll();
+	else
+		smt_low();
+}
+
 struct cpu_job *__cpu_queue_job(struct cpu_thread *cpu,
 				void (*func)(void *data), void *data,
 				bool no_return)
@@ -85,32 +206,57 @@ struct cpu_job *__cpu_queue_job(struct cpu_thread *cpu,
 		return NULL;
 	}
 
-	job = zalloc(sizeof(struct cpu_job));
+	job = cpu_job_get();
 	if (!job)
 		return NULL;
 	job->func = func;
 	job->data = data;
-	job->complete = false;
+	job->state = CPU_JOB_QUEUED;
 	job->no_return = no_return;
+	job->reported = false;
+	job->cpu = cpu;
+	job->group_next = NULL;
 
 	if (cpu != this_cpu()) {
-		lock(&cpu->job_lock);
-		list_add_tail(&cpu->job_queue, &job->link);
-		unlock(&cpu->job_lock);
+		/*
+		 * Wait for room if the ring is full. Our own jobs keep
+		 * running meanwhile, in case the target is waiting on them.
+		 */
+		while (!cpu_job_push(cpu, job))
+			cpu_wait_poll();
+		smt_medium();
 	} else {
 		func(data);
-		job->complete = true;
-	}
+		job->state = CPU_JOB_DONE;
 
-	/* XXX Add poking of CPU with interrupt */
+		/* Nobody owns a no_return job, the pointer only means success */
+		if (no_return)
+			cpu_job_put(job);
+	}
 
 	return job;
 }
 
+static void cpu_job_done(struct cpu_job *job)
+{
+	lwsync();
+	if (__lock_cmpxchg(&job->state, CPU_JOB_QUEUED, CPU_JOB_DONE)
+	    != CPU_JOB_QUEUED)
+		cpu_job_put(job);
+}
+
+/* Called by the waiter when it gives up on a job */
+static void cpu_job_abandon(struct cpu_job *job)
+{
+	if (__lock_cmpxchg(&job->state, CPU_JOB_QUEUED, CPU_JOB_ABANDONED)
+	    != CPU_JOB_QUEUED)
+		cpu_job_put(job);
+}
+
 bool cpu_poll_job(struct cpu_job *job)
 {
 	lwsync();
-	return job->complete;
+	return *(volatile unsigned long *)&job->state == CPU_JOB_DONE;
 }
 
 void cpu_wait_job(struct cpu_job *job, bool free_it)
@@ -118,19 +264,13 @@ void cpu_wait_job(struct cpu_job *job, bool free_it)
 	if (!job)
 		return;
 
-	while(!job->complete) {
-		/* Handle mbox if master CPU */
-		if (this_cpu() == boot_cpu)
-			fsp_poll();
-		else
-			smt_low();
-		lwsync();
-	}
+	while(!cpu_poll_job(job))
+		cpu_wait_poll();
 	lwsync();
 	smt_medium();
 
 	if (free_it)
-		free(job);
+		cpu_job_put(job);
 }
 
 void cpu_free_job(struct cpu_job *job)
@@ -138,8 +278,105 @@ void cpu_free_job(struct cpu_job *job)
 	if (!job)
 		return;
 
-	assert(job->complete);
-	free(job);
+	assert(cpu_poll_job(job));
+	cpu_job_put(job);
+}
+
+void cpu_job_group_init(struct cpu_job_group *group)
+{
+	group->first = NULL;
+	group->count = 0;
+}
+
+struct cpu_job *cpu_job_group_queue(struct cpu_job_group *group,
+				    struct cpu_thread *cpu,
+				    void (*func)(void *data), void *data)
+{
+	struct cpu_job *job = cpu_queue_job(cpu, func, data);
+
+	if (!job)
+		return NULL;
+	job->group_next = group->first;
+	group->first = job;
+	group->count++;
+	return job;
+}
+
+struct cpu_thread *cpu_job_cpu(struct cpu_job *job)
+{
+	return job->cpu;
+}
+
+static unsigned int cpu_job_group_pending(struct cpu_job_group *group)
+{
+	struct cpu_job *job;
+	unsigned int pending = 0;
+
+	for (job = group->first; job; job = job->group_next)
+		if (!cpu_poll_job(job))
+			pending++;
+	return pending;
+}
+
+unsigned int cpu_job_group_wait_all(struct cpu_job_group *group,
+				    unsigned long timeout)
+{
+	unsigned long end = mftb() + timeout;
+	unsigned int pending;
+
+	while ((pending = cpu_job_group_pending(group)) != 0) {
+		if (timeout && tb_compare(mftb(), end) == TB_AAFTERB)
+			break;
+		cpu_wait_poll();
+	}
+	smt_medium();
+	lwsync();
+	return pending;
+}
+
+struct cpu_job *cpu_job_group_wait_any(struct cpu_job_group *group,
+				       unsigned long timeout)
+{
+	unsigned long end = mftb() + timeout;
+	struct cpu_job *job;
+	bool left;
+
+	for (;;) {
+		left = false;
+		for (job = group->first; job; job = job->group_next) {
+			if (job->reported)
+				continue;
+			if (cpu_poll_job(job)) {
+				job->reported = true;
+				smt_medium();
+				return job;
+			}
+			left = true;
+		}
+		if (!left ||
+		    (timeout && tb_compare(mftb(), end) == TB_AAFTERB))
+			break;
+		cpu_wait_poll();
+	}
+	smt_medium();
+	return NULL;
+}
+
+void cpu_job_group_release(struct cpu_job_group *group)
+{
+	struct cpu_job *job, *next;
+
+	for (job = group->first; job; job = next) {
+		next = job->group_next;
+		if (cpu_poll_job(job))
+			cpu_job_put(job);
+		else {
+			prerror("CPU: Job %p on CPU 0x%04x timed out\n",
+				job->func, job->cpu->pir);
+			cpu_job_abandon(job);
+		}
+	}
+	cpu_job_group_init(group);
 }
 
 void cpu_process_jobs(void)
@@ -148,35 +385,233 @@ void cpu_process_jobs(void)
 	struct cpu_job *job;
 	void (*func)(void *);
 	void *data;
+	bool no_return;
 
 	sync();
-	if (list_empty(&cpu->job_queue))
-		return;
-
-	lock(&cpu->job_lock);
-	while (true) {
-		bool no_return;
-
-		if (list_empty(&cpu->job_queue))
-			break;
-		smt_medium();
-		job = list_pop(&cpu->job_queue, struct cpu_job, link);
-		if (!job)
-			break;
+	while ((job = cpu_job_pop(cpu)) != NULL) {
 		func = job->func;
 		data = job->data;
 		no_return = job->no_return;
-		unlock(&cpu->job_lock);
 		if (no_return)
-			free(job);
+			cpu_job_put(job);
 		func(data);
-		lock(&cpu->job_lock);
-		if (!no_return) {
-			lwsync();
-			job->complete = true;
-		}
+		if (!no_return)
+			cpu_job_done(job);
+	}
+}
+
+void cpu_idle(void)
+{
+	struct cpu_thread *cpu = this_cpu();
+
+	/* Nothing to do, so we have no use for cached objects either */
+	if (!cpu_job_pending(cpu))
+		slab_drain();
+
+	/* Only our own ring is polled, nothing is shared */
+	while (!cpu_job_pending(cpu))
+		smt_very_low();
+	smt_medium();
+}
+
+struct latency_probe {
+	unsigned long	queued;
+	unsigned long	started;
+};
+
+static void cpu_latency_job(void *data)
+{
+	struct latency_probe *p = data;
+
+	p->started = mftb();
+}
+
+void cpu_job_latency_test(void)
+{
+	unsigned long lat, min = -1ul, max = 0, total = 0, count = 0;
+	struct latency_probe probe;
+	struct cpu_thread *cpu;
+	struct cpu_job *job;
+
+	for_each_available_cpu(cpu) {
+		if (cpu == this_cpu())
+			continue;
+
+		probe.queued = mftb();
+		job = cpu_queue_job(cpu, cpu_latency_job, &probe);
+		if (!job)
+			continue;
+		cpu_wait_job(job, true);
+
+		lat = probe.started - probe.queued;
+		if (lat < min)
+			min = lat;
+		if (lat > max)
+			max = lat;
+		total += lat;
+		count++;
+	}
+	if (!count)
+		return;
+
+	printf("CPU: Job dispatch latency over %lu CPUs:"
+	       " min %luns avg %luns max %luns\n", count,
+	       tb_to_nsecs(min), tb_to_nsecs(total / count), tb_to_nsecs(max));
+}
+
+/*
+ * Fork/join helpers. Workers are no_return jobs, so their descriptors
+ * go back to the pool as soon as they start, and the caller joins on
+ * a single pending count instead of on each job.
+ */
+struct cpu_parallel {
+	void		(*func)(unsigned int i, void *data);
+	void		*data;
+	unsigned long	next;
+	unsigned long	end;
+	unsigned long	pending;
+};
+
+struct cpu_parallel_chip {
+	struct cpu_parallel	*par;
+	u32			chip_id;
+	bool			local;
+};
+
+static unsigned long cpu_atomic_add(unsigned long *p, long val)
+{
+	unsigned long old;
+
+	do {
+		old = *(volatile unsigned long *)p;
+	} while (__lock_cmpxchg(p, old, old + val) != old);
+	return old;
+}
+
+static void cpu_parallel_done(struct cpu_parallel *par)
+{
+	lwsync();
+	cpu_atomic_add(&par->pending, -1);
+}
+
+static void cpu_parallel_join(struct cpu_parallel *par)
+{
+	while (*(volatile unsigned long *)&par->pending)
+		cpu_wait_poll();
+	smt_medium();
+	sync();
+}
+
+/* Claim indexes until there are none left */
+static void cpu_parallel_run(struct cpu_parallel *par)
+{
+	unsigned long i;
+
+	while ((i = cpu_atomic_add(&par->next, 1)) < par->end)
+		par->func(i, par->data);
+}
+
+static void cpu_parallel_job(void *data)
+{
+	struct cpu_parallel *par = data;
+
+	cpu_parallel_run(par);
+	cpu_parallel_done(par);
+}
+
+/*
+ * Only secondaries which called in sit in the job loop. The boot CPU
+ * and threads doing an rvwinkle cycle would leave a share waiting.
+ */
+static bool cpu_parallel_worker(struct cpu_thread *cpu)
+{
+	return cpu->state == cpu_state_active && cpu != boot_cpu &&
+		cpu != this_cpu();
+}
+
+void cpu_parallel_for(unsigned int start, unsigned int end,
+		      void (*func)(unsigned int i, void *data), void *data)
+{
+	struct cpu_parallel par = {
+		.func	= func,
+		.data	= data,
+		.next	= start,
+		.end	= end,
+	};
+	struct cpu_thread *cpu;
+	unsigned int workers = 0;
+
+	if (start >= end)
+		return;
+
+	/* One worker per other CPU, we take a share ourselves */
+	for_each_available_cpu(cpu) {
+		if (!cpu_parallel_worker(cpu))
+			continue;
+		if (workers >= end - start - 1)
+			break;
+		cpu_atomic_add(&par.pending, 1);
+		if (__cpu_queue_job(cpu, cpu_parallel_job, &par, true))
+			workers++;
+		else
+			cpu_parallel_done(&par);
+	}
+
+	cpu_parallel_run(&par);
+	cpu_parallel_join(&par);
+}
+
+static void cpu_parallel_chip_job(void *data)
+{
+	struct cpu_parallel_chip *pc = data;
+
+	pc->par->func(pc->chip_id, pc->par->data);
+	cpu_parallel_done(pc->par);
+}
+
+/* Any worker thread on the chip */
+static struct cpu_thread *cpu_pick_on_chip(u32 chip_id)
+{
+	struct cpu_thread *cpu;
+
+	for_each_available_cpu(cpu) {
+		if (cpu->chip_id == chip_id && cpu_parallel_worker(cpu))
+			return cpu;
 	}
-	unlock(&cpu->job_lock);
+	return NULL;
+}
+
+void cpu_parallel_for_chips(void (*func)(unsigned int chip_id, void *data),
+			    void *data)
+{
+	struct cpu_parallel par = {
+		.func	= func,
+		.data	= data,
+	};
+	struct cpu_parallel_chip chips[MAX_CHIPS];
+	struct proc_chip *chip;
+	struct cpu_thread *cpu;
+	unsigned int i, n = 0;
+
+	for_each_chip(chip) {
+		assert(n < MAX_CHIPS);
+		chips[n].par = &par;
+		chips[n].chip_id = chip->id;
+		cpu_atomic_add(&par.pending, 1);
+
+		cpu = cpu_pick_on_chip(chip->id);
+		chips[n].local = !cpu ||
+			!__cpu_queue_job(cpu, cpu_parallel_chip_job,
+					 &chips[n], true);
+		n++;
+	}
+
+	/* Chips without another thread are done by us */
+	for (i = 0; i < n; i++)
+		if (chips[i].local)
+			cpu_parallel_chip_job(&chips[i]);
+
+	cpu_parallel_join(&par);
 }
 
 struct dt_node *get_cpu_node(u32 pir)
@@ -324,8 +759,8 @@ static void init_cpu_thread(struct cpu_thread *t,
 			    enum cpu_thread_state state,
 			    unsigned int pir)
 {
-	init_lock(&t->job_lock);
-	list_head_init(&t->job_queue);
+	memset(t->job_ring, 0, sizeof(t->job_ring));
+	t->job_head = t->job_tail = 0;
 	t->state = state;
 	t->pir = pir;
 	assert(pir == container_of(t, struct cpu_stack, cpu) - cpu_stacks);
@@ -578,9 +1013,10 @@ static int64_t opal_return_cpu(void)
 }
 opal_call(OPAL_RETURN_CPU, opal_return_cpu, 0);
 
-static void cpu_change_hile(void *hilep)
+static void cpu_change_hile(void *data)
 {
-	bool hile = *(bool *)hilep;
+	bool hile = (unsigned long)data;
+	struct cpu_thread *cpu;
 	unsigned long hid0;
 
 	hid0 = mfspr(SPR_HID0);
@@ -591,25 +1027,42 @@ static void cpu_change_hile(void *hilep)
 	printf("CPU: [%08x] HID0 set to 0x%016lx\n", this_cpu()->pir, hid0);
 	set_hid0(hid0);
 
-	this_cpu()->current_hile = hile;
+	/* HID0 is per core, that was it for our siblings too */
+	for_each_cpu(cpu)
+		if (cpu_is_sibling(cpu, this_cpu()))
+			cpu->current_hile = hile;
 }
 
 static int64_t cpu_change_all_hile(bool hile)
 {
+	struct cpu_job_group group;
 	struct cpu_thread *cpu;
+	unsigned int stuck = 0;
 
 	printf("CPU: Switching HILE on all CPUs to %d\n", hile);
 
+	/*
+	 * One job per core, on its primary thread. The value travels in
+	 * the job itself, and every core gets a job even if it looks
+	 * switched already: a job abandoned by an earlier call may still
+	 * be queued there, and only a later job in the same ring is sure
+	 * to run after it.
+	 */
+	cpu_job_group_init(&group);
 	for_each_available_cpu(cpu) {
-		if (cpu->current_hile == hile)
-			continue;
-		if (cpu == this_cpu()) {
-			cpu_change_hile(&hile);
+		if (!cpu_is_thread0(cpu) || cpu_is_sibling(cpu, this_cpu()))
 			continue;
-		}
-		cpu_wait_job(cpu_queue_job(cpu, cpu_change_hile, &hile), true);
+		if (!cpu_job_group_queue(&group, cpu, cpu_change_hile,
+					 (void *)(unsigned long)hile))
+			stuck++;
 	}
-	return OPAL_SUCCESS;
+	cpu_change_hile((void *)(unsigned long)hile);
+
+	/* A wedged thread fails the call rather than hanging it */
+	stuck += cpu_job_group_wait_all(&group, secs_to_tb(1));
+	cpu_job_group_release(&group);
+
+	return stuck ? OPAL_HARDWARE : OPAL_SUCCESS;
 }
 
 static int64_t opal_reinit_cpus(uint64_t flags)
@@ -16,6 +16,7 @@
 
 #include <device.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include <skiboot.h>
 #include <libfdt/libfdt.h>
 #include <libfdt/libfdt_internal.h>
@@ -28,24 +29,484 @@ u32 last_phandle = 0;
 struct dt_node *dt_root;
 struct dt_node *dt_chosen;
 
+/*
+ * Locking: there is none. The arena, the interned names table and the
+ * list of property indexes below are shared by the whole tree, so
+ * creating, changing or freeing any node or property must only be done
+ * from the boot CPU (or with every other CPU kept out of the tree, as
+ * during fast reboot). Lookups, including the compatible and phandle
+ * indexes, don't write anything, so any number of CPUs (parallel jobs,
+ * OPAL calls) may search the tree at once, just not while it changes.
+ */
+
+/*
+ * Device tree arena.
+ *
+ * While building a tree in bulk (HDAT parsing, dt_expand) nodes,
+ * properties and names are bump-allocated from large chunks instead
+ * of going to the heap one by one. Freeing such an object only drops
+ * the count of live objects, and the chunks are all given back once
+ * that reaches zero outside of a build.
+ */
+struct dt_arena_chunk {
+	struct list_node list;
+	size_t used;
+	char data[] __attribute__((aligned(8)));
+};
+
+#define DT_ARENA_CHUNK_SIZE	0x10000
+#define DT_ARENA_MAX_OBJ	0x400
+
+static struct {
+	struct list_head chunks;
+	unsigned int depth;
+	unsigned long live;
+} dt_arena = {
+	.chunks = LIST_HEAD_INIT(dt_arena.chunks),
+};
+
+static bool dt_arena_owns(const void *p)
+{
+	struct dt_arena_chunk *c;
+
+	list_for_each(&dt_arena.chunks, c, list)
+		if ((const char *)p >= c->data
+		    && (const char *)p < c->data + c->used)
+			return true;
+	return false;
+}
+
+static void *dt_arena_alloc(size_t size)
+{
+	struct dt_arena_chunk *c;
+	void *p;
+
+	size = ALIGN_UP(size, 8);
+	c = list_tail(&dt_arena.chunks, struct dt_arena_chunk, list);
+	if (!c || c->used + size > DT_ARENA_CHUNK_SIZE - sizeof(*c)) {
+		c = malloc(DT_ARENA_CHUNK_SIZE);
+		if (!c)
+			return NULL;
+		c->used = 0;
+		list_add_tail(&dt_arena.chunks, &c->list);
+	}
+	p = c->data + c->used;
+	c->used += size;
+	dt_arena.live++;
+	return p;
+}
+
+static void dt_arena_release(void)
+{
+	struct dt_arena_chunk *c;
+
+	if (dt_arena.live || dt_arena.depth)
+		return;
+	while ((c = list_pop(&dt_arena.chunks, struct dt_arena_chunk, list)))
+		free(c);
+}
+
+void dt_arena_begin(void)
+{
+	dt_arena.depth++;
+}
+
+void dt_arena_end(void)
+{
+	assert(dt_arena.depth);
+	dt_arena.depth--;
+	dt_arena_release();
+}
+
+static void *dt_alloc(size_t size)
+{
+	void *p = NULL;
+
+	if (dt_arena.depth && size <= DT_ARENA_MAX_OBJ)
+		p = dt_arena_alloc(size);
+	return p ? p : malloc(size);
+}
+
+static void dt_release(void *p)
+{
+	if (!dt_arena_owns(p)) {
+		free(p);
+		return;
+	}
+	assert(dt_arena.live);
+	dt_arena.live--;
+	dt_arena_release();
+}
+
 static const char *take_name(const char *name)
 {
-	if (!is_rodata(name) && !(name = strdup(name))) {
+	size_t len;
+	char *copy;
+
+	if (is_rodata(name))
+		return name;
+
+	len = strlen(name) + 1;
+	copy = dt_alloc(len);
+	if (!copy) {
 		prerror("Failed to allocate copy of name");
 		abort();
 	}
-	return name;
+	return memcpy(copy, name, len);
 }
 
 static void free_name(const char *name)
 {
 	if (!is_rodata(name))
-		free((char *)name);
+		dt_release((char *)name);
+}
+
+/*
+ * Interned property names, open addressed on a hash of the string.
+ * Names are never freed, there are only a few hundred distinct ones.
+ */
+static struct {
+	const char **names;
+	unsigned int size;
+	unsigned int count;
+} dt_names;
+
+static unsigned long dt_name_hash(const char *name)
+{
+	unsigned long hash = 5381;
+
+	while (*name)
+		hash = hash * 33 + (unsigned char)*(name++);
+	return hash;
+}
+
+static const char **dt_name_slot(const char **names, unsigned int size,
+				 const char *name)
+{
+	unsigned int i = dt_name_hash(name) & (size - 1);
+
+	while (names[i] && strcmp(names[i], name))
+		i = (i + 1) & (size - 1);
+	return &names[i];
+}
+
+static void dt_names_grow(void)
+{
+	unsigned int i, size = dt_names.size ? dt_names.size * 2 : 256;
+	const char **names = zalloc(size * sizeof(*names));
+
+	if (!names) {
+		prerror("Failed to allocate property names table\n");
+		abort();
+	}
+	for (i = 0; i < dt_names.size; i++)
+		if (dt_names.names[i])
+			*dt_name_slot(names, size, dt_names.names[i]) =
+				dt_names.names[i];
+	free(dt_names.names);
+	dt_names.names = names;
+	dt_names.size = size;
+}
+
+const char *dt_find_name(const char *name)
+{
+	if (!dt_names.size)
+		return NULL;
+	return *dt_name_slot(dt_names.names, dt_names.size, name);
+}
+
+static const char *dt_intern_name(const char *name)
+{
+	const char **slot;
+
+	if (dt_names.count * 2 >= dt_names.size)
+		dt_names_grow();
+
+	slot = dt_name_slot(dt_names.names, dt_names.size, name);
+	if (!*slot) {
+		if (is_rodata(name))
+			*slot = name;
+		else if (!(*slot = strdup(name))) {
+			prerror("Failed to allocate copy of name");
+			abort();
+		}
+		dt_names.count++;
+	}
+	return *slot;
+}
+
+/*
+ * Per-node property index, keyed on the interned name pointer. All of
+ * them are kept on a list so dt_resize_property(), which doesn't know
+ * the node, can fix up the one pointing at the property it moves.
+ */
+struct dt_prop_index {
+	struct list_node list;
+	unsigned int size;
+	struct dt_property *props[];
+};
+
+static LIST_HEAD(dt_prop_indexes);
+
+static struct dt_property **dt_index_slot(struct dt_prop_index *idx,
+					  const char *name)
+{
+	unsigned long hash = (unsigned long)name * 0x9e3779b97f4a7c15ul;
+	unsigned int i = (hash >> 32) & (idx->size - 1);
+
+	while (idx->props[i] && idx->props[i]->name != name)
+		i = (i + 1) & (idx->size - 1);
+	return &idx->props[i];
+}
+
+static void dt_index_free(struct dt_node *node)
+{
+	if (!node->prop_index)
+		return;
+	list_del(&node->prop_index->list);
+	free(node->prop_index);
+	node->prop_index = NULL;
+}
+
+static void dt_index_build(struct dt_node *node)
+{
+	struct dt_prop_index *idx;
+	struct dt_property *p;
+	unsigned int size = 16;
+
+	dt_index_free(node);
+	if (node->num_props <= DT_PROP_INDEX_MIN)
+		return;
+
+	/* Keep it at most half full */
+	while (size < node->num_props * 4)
+		size *= 2;
+	idx = zalloc(sizeof(*idx) + size * sizeof(idx->props[0]));
+	if (!idx)
+		return;
+	idx->size = size;
+	list_for_each(&node->properties, p, list)
+		*dt_index_slot(idx, p->name) = p;
+	list_add(&dt_prop_indexes, &idx->list);
+	node->prop_index = idx;
+}
+
+static void dt_index_add(struct dt_node *node, struct dt_property *p)
+{
+	struct dt_prop_index *idx = node->prop_index;
+
+	if (!idx || node->num_props * 2 > idx->size)
+		dt_index_build(node);
+	else
+		*dt_index_slot(idx, p->name) = p;
+}
+
+/*
+ * Search indexes: phandle to node, and compatible string to the list of
+ * nodes with it, kept in tree order as nodes come and go so lookups
+ * never write to it. Both span every node, attached or not; searches
+ * filter on the root they were given.
+ */
+#define DT_PHANDLE_BUCKETS	1024
+#define DT_COMPAT_BUCKETS	256
+
+struct dt_compat {
+	struct dt_compat *next;
+	const char *compat;
+	unsigned int count, max;
+	struct dt_node **nodes;
+};
+
+static struct dt_node *dt_phandles[DT_PHANDLE_BUCKETS];
+static struct dt_compat *dt_compats[DT_COMPAT_BUCKETS];
+static u32 dt_seq;
+
+static void dt_phandle_add(struct dt_node *node)
+{
+	struct dt_node **head = &dt_phandles[node->phandle % DT_PHANDLE_BUCKETS];
+
+	node->phandle_next = *head;
+	*head = node;
+}
+
+static void dt_phandle_del(struct dt_node *node)
+{
+	struct dt_node **n = &dt_phandles[node->phandle % DT_PHANDLE_BUCKETS];
+
+	while (*n != node)
+		n = &(*n)->phandle_next;
+	*n = node->phandle_next;
+}
+
+static unsigned int dt_compat_hash(const char *compat)
+{
+	unsigned int hash = 5381;
+
+	while (*compat)
+		hash = hash * 33 + tolower((unsigned char)*(compat++));
+	return hash % DT_COMPAT_BUCKETS;
+}
+
+static struct dt_compat *dt_compat_get(const char *compat, bool create)
+{
+	struct dt_compat **head = &dt_compats[dt_compat_hash(compat)], *c;
+
+	for (c = *head; c; c = c->next)
+		if (!strcasecmp(c->compat, compat))
+			return c;
+	if (!create)
+		return NULL;
+
+	c = zalloc(sizeof(*c));
+	if (!c || !(c->compat = strdup(compat))) {
+		prerror("Failed to allocate compatible index\n");
+		abort();
+	}
+	c->next = *head;
+	*head = c;
+	return c;
+}
+
+static unsigned int dt_depth(const struct dt_node *node)
+{
+	unsigned int depth = 0;
+
+	while ((node = node->parent))
+		depth++;
+	return depth;
+}
+
+/* Tree (ie. dt_next) order, separate trees in order of creation */
+static int dt_order(const struct dt_node *a, const struct dt_node *b)
+{
+	unsigned int da = dt_depth(a), db = dt_depth(b);
+
+	for (; da > db; da--) {
+		a = a->parent;
+		if (a == b)
+			return 1;
+	}
+	for (; db > da; db--) {
+		b = b->parent;
+		if (a == b)
+			return -1;
+	}
+	if (a == b)
+		return 0;
+	while (a->parent != b->parent) {
+		a = a->parent;
+		b = b->parent;
+	}
+	return a->seq < b->seq ? -1 : 1;
+}
+
+static bool dt_under(const struct dt_node *node, const struct dt_node *root)
+{
+	for (; node; node = node->parent)
+		if (node == root)
+			return true;
+	return false;
+}
+
+/*
+ * Index in c of the first node after prev (or from root) in tree order.
+ * The nodes under root are contiguous from there.
+ */
+static unsigned int dt_compat_first(const struct dt_compat *c,
+				    const struct dt_node *root,
+				    const struct dt_node *prev)
+{
+	unsigned int lo = 0, hi = c->count, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (prev ? dt_order(c->nodes[mid], prev) <= 0
+			 : dt_order(c->nodes[mid], root) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void dt_compat_add(struct dt_node *node, const struct dt_property *p)
+{
+	const char *s = p->prop, *end = p->prop + p->len;
+	struct dt_compat *c;
+	unsigned int i;
+
+	for (; s < end; s += strlen(s) + 1) {
+		c = dt_compat_get(s, true);
+		if (c->count == c->max) {
+			c->max = c->max ? c->max * 2 : 4;
+			c->nodes = realloc(c->nodes,
+					   c->max * sizeof(c->nodes[0]));
+			assert(c->nodes);
+		}
+		/* Nodes mostly come in tree order, so check the end first */
+		i = c->count;
+		if (i && dt_order(c->nodes[i - 1], node) > 0)
+			i = dt_compat_first(c, NULL, node);
+		memmove(&c->nodes[i + 1], &c->nodes[i],
+			(c->count - i) * sizeof(c->nodes[0]));
+		c->nodes[i] = node;
+		c->count++;
+	}
+}
+
+static void dt_compat_del(struct dt_node *node, const struct dt_property *p)
+{
+	const char *s = p->prop, *end = p->prop + p->len;
+	struct dt_compat *c;
+	unsigned int i;
+
+	for (; s < end; s += strlen(s) + 1) {
+		c = dt_compat_get(s, false);
+		for (i = 0; c && i < c->count; i++) {
+			if (c->nodes[i] != node)
+				continue;
+			memmove(&c->nodes[i], &c->nodes[i + 1],
+				(c->count - i - 1) * sizeof(c->nodes[0]));
+			c->count--;
+			break;
+		}
+	}
+}
+
+/*
+ * Grafting moves a whole subtree in tree order: take it out of the
+ * index before, and put it back after.
+ */
+static void dt_compat_subtree(struct dt_node *node, bool add)
+{
+	const struct dt_property *p;
+	struct dt_node *child;
+
+	p = dt_find_property(node, "compatible");
+	if (p && add)
+		dt_compat_add(node, p);
+	else if (p)
+		dt_compat_del(node, p);
+	dt_for_each_child(node, child)
+		dt_compat_subtree(child, add);
+}
+
+static bool is_compatible_prop(const struct dt_property *p)
+{
+	return strcmp(p->name, "compatible") == 0;
+}
+
+static void free_node(struct dt_node *node)
+{
+	dt_phandle_del(node);
+	dt_index_free(node);
+	free_name(node->name);
+	dt_release(node);
 }
 
 static struct dt_node *new_node(const char *name)
 {
-	struct dt_node *node = malloc(sizeof *node);
+	struct dt_node *node = dt_alloc(sizeof *node);
 	if (!node) {
 		prerror("Failed to allocate node\n");
 		abort();
@@ -53,10 +514,14 @@ static struct dt_node *new_node(const char *name)
 
 	node->name = take_name(name);
 	node->parent = NULL;
+	node->num_props = 0;
+	node->prop_index = NULL;
 	list_head_init(&node->properties);
 	list_head_init(&node->children);
+	node->seq = ++dt_seq;
 	/* FIXME: locking? */
 	node->phandle = ++last_phandle;
+	dt_phandle_add(node);
 	return node;
 }
 
@@ -79,8 +544,11 @@ bool dt_attach_root(struct dt_node *parent, struct dt_node *root)
 			return false;
 		}
 	}
+	dt_compat_subtree(root, false);
 	list_add_tail(&parent->children, &root->list);
 	root->parent = parent;
+	root->seq = ++dt_seq;
+	dt_compat_subtree(root, true);
 
 	return true;
 }
@@ -92,8 +560,7 @@ struct dt_node *dt_new(struct dt_node *parent, const char *name)
 
 	new = new_node(name);
 	if (!dt_attach_root(parent, new)) {
-		free_name(new->name);
-		free(new);
+		free_node(new);
 		return NULL;
 	}
 	return new;
@@ -115,8 +582,7 @@ struct dt_node *dt_new_addr(struct dt_node *parent, const char *name,
 	new = new_node(lname);
 	free(lname);
 	if (!dt_attach_root(parent, new)) {
-		free_name(new->name);
-		free(new);
+		free_node(new);
 		return NULL;
 	}
 	return new;
@@ -139,8 +605,7 @@ struct dt_node *dt_new_2addr(struct dt_node *parent, const char *name,
 	new = new_node(lname);
 	free(lname);
 	if (!dt_attach_root(parent, new)) {
-		free_name(new->name);
-		free(new);
+		free_node(new);
 		return NULL;
 	}
 	return new;
@@ -246,18 +711,27 @@ struct dt_node *dt_find_by_path(struct dt_node *root, const char *path)
 
 struct dt_node *dt_find_by_phandle(struct dt_node *root, u32 phandle)
 {
-	struct dt_node *node;
-
-	dt_for_each_node(root, node)
-		if (node->phandle == phandle)
-			return node;
-	return NULL;
+	struct dt_node *node, *found = NULL;
+
+	/* If it's duplicated, the first one in tree order wins */
+	node = dt_phandles[phandle % DT_PHANDLE_BUCKETS];
+	for (; node; node = node->phandle_next)
+		if (node->phandle == phandle && node != root
+		    && dt_under(node, root)
+		    && (!found || dt_order(node, found) < 0))
+			found = node;
+	return found;
 }
 
-static struct dt_property *new_property(struct dt_node *node,
-					const char *name, size_t size)
+/*
+ * If ext is set the value isn't copied, the property refers to it in
+ * place until dt_resize_property() is called on it.
+ */
+static struct dt_property *__new_property(struct dt_node *node,
+					  const char *name, size_t size,
+					  const void *ext)
 {
-	struct dt_property *p = malloc(sizeof(*p) + size);
+	struct dt_property *p = dt_alloc(sizeof(*p) + (ext ? 0 : size));
 	if (!p) {
 		prerror("Failed to allocate property \"%s\" for %s of %zu bytes\n",
 			name, dt_get_path(node), size);
@@ -270,15 +744,25 @@ static struct dt_property *new_property(struct dt_node *node,
 
 	}
 
-	p->name = take_name(name);
+	p->name = dt_intern_name(name);
 	p->len = size;
+	p->prop = ext ? (char *)ext : p->data;
 	list_add_tail(&node->properties, &p->list);
+	node->num_props++;
+	dt_index_add(node, p);
 	return p;
 }
 
-struct dt_property *dt_add_property(struct dt_node *node,
-				    const char *name,
-				    const void *val, size_t size)
+static struct dt_property *new_property(struct dt_node *node,
+					const char *name, size_t size)
+{
+	return __new_property(node, name, size, NULL);
+}
+
+static struct dt_property *__dt_add_property(struct dt_node *node,
+					     const char *name,
+					     const void *val, size_t size,
+					     bool copy)
 {
 	struct dt_property *p;
 
@@ -289,27 +773,67 @@ struct dt_property *dt_add_property(struct dt_node *node,
 	if (strcmp(name, "linux,phandle") == 0 ||
 	    strcmp(name, "phandle") == 0) {
 		assert(size == 4);
+		dt_phandle_del(node);
 		node->phandle = *(const u32 *)val;
+		dt_phandle_add(node);
 		if (node->phandle >= last_phandle)
 			last_phandle = node->phandle;
 		return NULL;
 	}
 
-	p = new_property(node, name, size);
-	if (size)
-		memcpy(p->prop, val, size);
+	if (!copy) {
+		p = __new_property(node, name, size, val);
+	} else {
+		p = new_property(node, name, size);
+		if (size)
+			memcpy(p->prop, val, size);
+	}
+	if (is_compatible_prop(p))
+		dt_compat_add(node, p);
 	return p;
 }
 
+struct dt_property *dt_add_property(struct dt_node *node,
+				    const char *name,
+				    const void *val, size_t size)
+{
+	return __dt_add_property(node, name, val, size, true);
+}
+
 void dt_resize_property(struct dt_property **prop, size_t len)
 {
 	size_t new_len = sizeof(**prop) + len;
+	struct dt_property *old = *prop, **slot = NULL;
+	size_t keep = len < old->len ? len : old->len;
+	struct dt_prop_index *idx;
+
+	/* Find it in the index of its node, if it has one. */
+	list_for_each(&dt_prop_indexes, idx, list) {
+		slot = dt_index_slot(idx, old->name);
+		if (*slot == old)
+			break;
+		slot = NULL;
+	}
 
-	*prop = realloc(*prop, new_len);
+	/*
+	 * Arena objects can't grow, and values still in the FDT get
+	 * their own copy now: move both to the heap.
+	 */
+	if (dt_arena_owns(old) || old->prop != old->data) {
+		*prop = malloc(new_len);
+		assert(*prop);
+		memcpy(*prop, old, sizeof(*old));
+		memcpy((*prop)->data, old->prop, keep);
+		dt_release(old);
+	} else
+		*prop = realloc(*prop, new_len);
+	(*prop)->prop = (*prop)->data;
 
 	/* Fix up linked lists in case we moved. (note: not an empty list). */
 	(*prop)->list.next->prev = &(*prop)->list;
 	(*prop)->list.prev->next = &(*prop)->list;
+	if (slot)
+		*slot = *prop;
 }
 
 struct dt_property *dt_add_property_string(struct dt_node *node,
@@ -400,14 +924,20 @@ struct dt_property *__dt_add_property_strings(struct dt_node *node,
 		}
 	}
 	va_end(args);
+	if (is_compatible_prop(p))
+		dt_compat_add(node, p);
 	return p;
 }
 
 void dt_del_property(struct dt_node *node, struct dt_property *prop)
 {
+	if (is_compatible_prop(prop))
+		dt_compat_del(node, prop);
 	list_del_from(&node->properties, &prop->list);
-	free_name(prop->name);
-	free(prop);
+	node->num_props--;
+	if (node->prop_index)
+		dt_index_build(node);
+	dt_release(prop);
 }
 
 u32 dt_property_get_cell(const struct dt_property *prop, u32 index)
@@ -447,8 +977,15 @@ struct dt_property *__dt_find_property(struct dt_node *node, const char *name)
 {
 	struct dt_property *i;
 
+	name = dt_find_name(name);
+	if (!name)
+		return NULL;
+
+	if (node->prop_index)
+		return *dt_index_slot(node->prop_index, name);
+
 	list_for_each(&node->properties, i, list)
-		if (strcmp(i->name, name) == 0)
+		if (i->name == name)
 			return i;
 	return NULL;
 }
@@ -456,12 +993,7 @@ struct dt_property *__dt_find_property(struct dt_node *node, const char *name)
 const struct dt_property *dt_find_property(const struct dt_node *node,
 					   const char *name)
 {
-	const struct dt_property *i;
-
-	list_for_each(&node->properties, i, list)
-		if (strcmp(i->name, name) == 0)
-			return i;
-	return NULL;
+	return __dt_find_property((struct dt_node *)node, name);
 }
 
 const struct dt_property *dt_require_property(const struct dt_node *node,
@@ -530,12 +1062,14 @@ struct dt_node *dt_find_compatible_node(struct dt_node *root,
 					struct dt_node *prev,
 					const char *compat)
 {
-	struct dt_node *node;
+	struct dt_compat *c = dt_compat_get(compat, false);
+	unsigned int i;
 
-	node = prev ? dt_next(root, prev) : root;
-	for (; node; node = dt_next(root, node))
-		if (dt_node_is_compatible(node, compat))
-			return node;
+	if (!c)
+		return NULL;
+	i = dt_compat_first(c, root, prev);
+	if (i < c->count && dt_under(c->nodes[i], root))
+		return c->nodes[i];
 	return NULL;
 }
 
@@ -628,17 +1162,18 @@ void dt_free(struct dt_node *node)
 		dt_free(child);
 
 	while ((p = list_pop(&node->properties, struct dt_property, list))) {
-		free_name(p->name);
-		free(p);
+		if (is_compatible_prop(p))
+			dt_compat_del(node, p);
+		dt_release(p);
 	}
 
 	if (node->parent)
 		list_del_from(&node->parent->children, &node->list);
-	free_name(node->name);
-	free(node);
+	free_node(node);
 }
 
-int dt_expand_node(struct dt_node *node, const void *fdt, int fdt_node)
+static int __dt_expand_node(struct dt_node *node, const void *fdt,
+			    int fdt_node, bool copy)
 {
 	const struct fdt_property *prop;
 	int offset, nextoffset, err;
@@ -661,14 +1196,14 @@ int dt_expand_node(struct dt_node *node, const void *fdt, int fdt_node)
 		case FDT_PROP:
 			prop = _fdt_offset_ptr(fdt, offset);
 			name = fdt_string(fdt, fdt32_to_cpu(prop->nameoff));
-			dt_add_property(node, name, prop->data,
-					fdt32_to_cpu(prop->len));
+			__dt_add_property(node, name, prop->data,
+					  fdt32_to_cpu(prop->len), copy);
 			break;
 		case FDT_BEGIN_NODE:
 			name = fdt_get_name(fdt, offset, NULL);
 			child = dt_new_root(name);
 			assert(child);
-			nextoffset = dt_expand_node(child, fdt, offset);
+			nextoffset = __dt_expand_node(child, fdt, offset, copy);
 
 			/*
 			 * This may fail in case of duplicate, keep it
@@ -685,13 +1220,35 @@ int dt_expand_node(struct dt_node *node, const void *fdt, int fdt_node)
 	return nextoffset;
 }
 
+int dt_expand_node(struct dt_node *node, const void *fdt, int fdt_node)
+{
+	return __dt_expand_node(node, fdt, fdt_node, true);
+}
+
+/*
+ * Like dt_expand_node() but property values are left in the blob, which
+ * must then outlive the tree. They are only copied when a property is
+ * resized, writing in place goes to the blob.
+ */
+int dt_expand_node_ref(struct dt_node *node, void *fdt, int fdt_node)
+{
+	return __dt_expand_node(node, fdt, fdt_node, false);
+}
+
 void dt_expand(const void *fdt)
 {
 	printf("FDT: Parsing fdt @%p\n", fdt);
 
 	dt_root = dt_new_root("");
 
-	dt_expand_node(dt_root, fdt, 0);
+	/*
+	 * Property values stay in the incoming blob, which the caller
+	 * reserves from the OS once the memory regions exist.
+	 */
+	if (fdt_check_header(fdt) == 0)
+		dt_expand_node_ref(dt_root, (void *)fdt, 0);
+	else
+		dt_expand_node(dt_root, fdt, 0);
 }
 
 u64 dt_get_number(const void *pdata, unsigned int cells)
@@ -759,14 +1316,16 @@ struct dt_node *dt_find_compatible_node_on_chip(struct dt_node *root,
 						const char *compat,
 						uint32_t chip_id)
 {
-	struct dt_node *node;
+	struct dt_compat *c = dt_compat_get(compat, false);
+	unsigned int i;
 
-	node = prev ? dt_next(root, prev) : root;
-	for (; node; node = dt_next(root, node)) {
-		u32 cid = __dt_get_chip_id(node);
-		if (cid == chip_id &&
-		    dt_node_is_compatible(node, compat))
-			return node;
+	if (!c)
+		return NULL;
+	for (i = dt_compat_first(c, root, prev); i < c->count; i++) {
+		if (!dt_under(c->nodes[i], root))
+			break;
+		if (__dt_get_chip_id(c->nodes[i]) == chip_id)
+			return c->nodes[i];
 	}
 	return NULL;
 }
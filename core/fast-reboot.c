@@ -26,6 +26,9 @@
 #include <memory.h>
 #include <pci.h>
 #include <chip.h>
+#include <device.h>
+#include <lock.h>
+#include <mem_region.h>
 
 /*
  * To get control of all threads, we sreset them via XSCOM after
@@ -213,36 +216,207 @@ static void cleanup_cpu_state(void)
 }
 
 #ifdef FAST_REBOOT_CLEARS_MEMORY
+/*
+ * We clear what the OS had, ie. the REGION_OS ranges, split in chunks
+ * of MEM_CLEAR_CHUNK and grouped by the chip owning the memory. The
+ * primary thread of every core then clears chunks of its own chip,
+ * so it's all NUMA local. Ranges of unknown chips are cleared by the
+ * boot CPU. The exception vectors are left alone.
+ */
+#define MEM_CLEAR_CHUNK		0x10000000ul	/* 256M */
+#define MEM_CLEAR_SKIP		0x2000ul
+
+struct mem_clear_chunk {
+	uint64_t	start;
+	uint64_t	end;
+};
+
+struct mem_clear_chip {
+	struct mem_clear_chunk	*chunks;
+	unsigned long		count;
+	unsigned long		next;		/* Claimed with cmpxchg */
+	bool			has_worker;
+	bool			no_chunks;	/* Left to the fallback */
+};
+
+static struct mem_clear_chip mem_clear_chips[MAX_CHIPS];
+static unsigned long mem_clear_done;		/* Bytes, for progress */
+
 static void fast_mem_clear(uint64_t start, uint64_t end)
 {
-	printf("MEMORY: Clearing %llx..%llx\n", start, end);
-
 	while(start < end) {
 		asm volatile("dcbz 0,%0" : : "r" (start) : "memory");
 		start += 128;
 	}
 }
 
-static void memory_reset(void)
+static void mem_clear_add(unsigned long *mem, unsigned long val)
 {
-	struct address_range *i;
-	uint64_t skistart = SKIBOOT_BASE;
-	uint64_t skiend = SKIBOOT_BASE + SKIBOOT_SIZE;
+	unsigned long old;
 
-	printf("MEMORY: Clearing ...\n");
+	do {
+		old = *(volatile unsigned long *)mem;
+	} while (__lock_cmpxchg(mem, old, old + val) != old);
+}
 
-	list_for_each(&address_ranges, i, list) {
-		uint64_t start = cleanup_addr(i->arange->start);
-		uint64_t end = cleanup_addr(i->arange->end);
+static void mem_clear_job(void *data)
+{
+	struct mem_clear_chip *c = data;
+	struct mem_clear_chunk *chunk;
+	unsigned long i;
+
+	for (;;) {
+		do {
+			i = *(volatile unsigned long *)&c->next;
+			if (i >= c->count)
+				return;
+		} while (__lock_cmpxchg(&c->next, i, i + 1) != i);
+
+		chunk = &c->chunks[i];
+		fast_mem_clear(chunk->start, chunk->end);
+		mem_clear_add(&mem_clear_done, chunk->end - chunk->start);
+	}
+}
 
-		if (start >= skiend || end <= skistart)
+static uint32_t mem_region_chip(struct mem_region *r)
+{
+	/* The OS reserve at the bottom has no node, it's on the boot chip */
+	if (!r->mem_node)
+		return this_cpu()->chip_id;
+	return dt_prop_get_u32_def(r->mem_node, "ibm,chip-id", 0xffffffff);
+}
+
+/* No chip's workers will get to it */
+static bool mem_region_orphan(struct mem_region *r)
+{
+	uint32_t chip_id = mem_region_chip(r);
+
+	if (chip_id >= MAX_CHIPS || !get_chip(chip_id))
+		return true;
+	return mem_clear_chips[chip_id].no_chunks;
+}
+
+/* Count (clear == false) or clear the orphan ranges, returns bytes */
+static unsigned long mem_clear_orphans(bool clear)
+{
+	struct mem_region *r;
+	uint64_t start, end;
+	unsigned long bytes = 0;
+
+	for (r = mem_region_next(NULL); r; r = mem_region_next(r)) {
+		if (r->type != REGION_OS || !mem_region_orphan(r))
+			continue;
+		start = r->start;
+		end = r->start + r->len;
+		if (start < MEM_CLEAR_SKIP)
+			start = MEM_CLEAR_SKIP;
+		if (start >= end)
+			continue;
+		if (clear) {
 			fast_mem_clear(start, end);
-		else {
-			if (start < skistart)
-				fast_mem_clear(start, skistart);
-			if (end > skiend)
-				fast_mem_clear(skiend, end);
+			mem_clear_add(&mem_clear_done, end - start);
 		}
+		bytes += end - start;
+	}
+	return bytes;
+}
+
+/* Count (chunks == NULL) or fill in the chunks of a chip */
+static unsigned long mem_clear_split(uint32_t chip_id,
+				     struct mem_clear_chunk *chunks)
+{
+	struct mem_region *r;
+	uint64_t start, end, len;
+	unsigned long n = 0;
+
+	for (r = mem_region_next(NULL); r; r = mem_region_next(r)) {
+		if (r->type != REGION_OS || mem_region_chip(r) != chip_id)
+			continue;
+		start = r->start;
+		end = r->start + r->len;
+		if (start < MEM_CLEAR_SKIP)
+			start = MEM_CLEAR_SKIP;
+		for (; start < end; start += len, n++) {
+			len = end - start;
+			if (len > MEM_CLEAR_CHUNK)
+				len = MEM_CLEAR_CHUNK;
+			if (chunks) {
+				chunks[n].start = start;
+				chunks[n].end = start + len;
+			}
+		}
+	}
+	return n;
+}
+
+static void memory_reset(void)
+{
+	struct cpu_job_group group;
+	struct mem_clear_chip *c;
+	struct proc_chip *chip;
+	struct cpu_thread *cpu;
+	unsigned long total = 0, tb_start, ms, mbps, i;
+	unsigned int pending;
+
+	printf("MEMORY: Clearing ...\n");
+
+	mem_clear_done = 0;
+	for_each_chip(chip) {
+		c = &mem_clear_chips[chip->id];
+		c->count = mem_clear_split(chip->id, NULL);
+		c->next = 0;
+		c->has_worker = false;
+		c->no_chunks = false;
+		c->chunks = c->count ? malloc(c->count * sizeof(*c->chunks))
+				     : NULL;
+		if (c->count && !c->chunks) {
+			prerror("MEMORY: No memory for chip %d chunks\n",
+				chip->id);
+			c->count = 0;
+			c->no_chunks = true;
+			continue;
+		}
+		mem_clear_split(chip->id, c->chunks);
+		for (i = 0; i < c->count; i++)
+			total += c->chunks[i].end - c->chunks[i].start;
+	}
+	total += mem_clear_orphans(false);
+
+	tb_start = mftb();
+	cpu_job_group_init(&group);
+	for_each_available_cpu(cpu) {
+		if (cpu == this_cpu() || !cpu_is_thread0(cpu))
+			continue;
+		c = &mem_clear_chips[cpu->chip_id];
+		if (!c->count)
+			continue;
+		if (cpu_job_group_queue(&group, cpu, mem_clear_job, c))
+			c->has_worker = true;
+	}
+
+	/* Chips nobody else can do are ours */
+	for_each_chip(chip) {
+		c = &mem_clear_chips[chip->id];
+		if (c->count && !c->has_worker)
+			mem_clear_job(c);
+	}
+	mem_clear_orphans(true);
+
+	while ((pending = cpu_job_group_wait_all(&group, secs_to_tb(1))))
+		printf("MEMORY: Cleared %lu of %lu GB, %u cores busy\n",
+		       mem_clear_done >> 30, total >> 30, pending);
+	cpu_job_group_release(&group);
+
+	ms = tb_to_msecs(mftb() - tb_start) ? : 1;
+	mbps = (mem_clear_done >> 20) * 1000 / ms;
+	printf("MEMORY: Cleared %lu MB in %lu ms, %lu.%02lu GB/s\n",
+	       mem_clear_done >> 20, ms, mbps / 1024,
+	       (mbps % 1024) * 100 / 1024);
+
+	for_each_chip(chip) {
+		c = &mem_clear_chips[chip->id];
+		free(c->chunks);
+		c->chunks = NULL;
 	}
 }
 #endif /* FAST_REBOOT_CLEARS_MEMORY */
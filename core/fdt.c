@@ -27,49 +27,191 @@
 #include <vpd.h>
 #include <ccan/str/str.h>
 
-static int fdt_error;
+#include <libfdt_internal.h>
+
 static void *fdt;
 
 #undef DEBUG_FDT
 
-static void __save_err(int err, const char *str)
+/*
+ * The live tree is flattened in two passes: the first one works out the
+ * exact size of the structure and strings blocks, with each property
+ * name stored only once, the second writes the blob straight into a
+ * buffer of just the right size.
+ */
+struct fdt_strings {
+	const char **names;
+	u32 *offsets;
+	unsigned int size, count;
+	size_t len;
+};
+
+static struct fdt_strings fdt_strings;
+
+static const char *fdt_phandle_names[] = { "linux,phandle", "phandle" };
+
+static unsigned int fdt_string_hash(const char *name)
 {
-#ifdef DEBUG_FDT
-	printf("FDT: rc: %d from \"%s\"\n", err, str);
-#endif
-	if (err && !fdt_error) {
-		prerror("FDT: Error %d from \"%s\"\n", err, str);
-		fdt_error = err;
+	unsigned int hash = 5381;
+
+	while (*name)
+		hash = hash * 33 + (unsigned char)*(name++);
+	return hash;
+}
+
+static unsigned int fdt_string_slot(const char **names, unsigned int size,
+				    const char *name)
+{
+	unsigned int i = fdt_string_hash(name) & (size - 1);
+
+	while (names[i] && names[i] != name && strcmp(names[i], name))
+		i = (i + 1) & (size - 1);
+	return i;
+}
+
+static bool fdt_strings_grow(void)
+{
+	struct fdt_strings old = fdt_strings;
+	unsigned int i, slot, size = old.size ? old.size * 2 : 512;
+
+	fdt_strings.names = zalloc(size * sizeof(*fdt_strings.names));
+	fdt_strings.offsets = malloc(size * sizeof(*fdt_strings.offsets));
+	if (!fdt_strings.names || !fdt_strings.offsets) {
+		free(fdt_strings.names);
+		free(fdt_strings.offsets);
+		fdt_strings = old;
+		return false;
+	}
+	fdt_strings.size = size;
+	for (i = 0; i < old.size; i++) {
+		if (!old.names[i])
+			continue;
+		slot = fdt_string_slot(fdt_strings.names, size, old.names[i]);
+		fdt_strings.names[slot] = old.names[i];
+		fdt_strings.offsets[slot] = old.offsets[i];
+	}
+	free(old.names);
+	free(old.offsets);
+	return true;
+}
+
+/* Offset of name in the strings block, adding it if it's new */
+static int fdt_string_add(const char *name)
+{
+	unsigned int slot;
+
+	if (fdt_strings.count * 2 >= fdt_strings.size && !fdt_strings_grow())
+		return -1;
+
+	slot = fdt_string_slot(fdt_strings.names, fdt_strings.size, name);
+	if (!fdt_strings.names[slot]) {
+		fdt_strings.names[slot] = name;
+		fdt_strings.offsets[slot] = fdt_strings.len;
+		fdt_strings.len += strlen(name) + 1;
+		fdt_strings.count++;
 	}
+	return fdt_strings.offsets[slot];
 }
 
-#define save_err(...) __save_err(__VA_ARGS__, #__VA_ARGS__)
+static u32 fdt_string_offset(const char *name)
+{
+	return fdt_strings.offsets[fdt_string_slot(fdt_strings.names,
+						   fdt_strings.size, name)];
+}
 
-static void dt_property_cell(const char *name, u32 cell)
+static void fdt_strings_free(void)
 {
-	save_err(fdt_property_cell(fdt, name, cell));
+	free(fdt_strings.names);
+	free(fdt_strings.offsets);
+	memset(&fdt_strings, 0, sizeof(fdt_strings));
 }
 
-static void dt_begin_node(const char *name, uint32_t phandle)
+static size_t fdt_prop_size(size_t len)
 {
-	save_err(fdt_begin_node(fdt, name));
+	return sizeof(struct fdt_property) + FDT_TAGALIGN(len);
+}
 
-	/*
-	 * We add both the new style "phandle" and the legacy
-	 * "linux,phandle" properties
-	 */
-	dt_property_cell("linux,phandle", phandle);
-	dt_property_cell("phandle", phandle);
+/* Add up the structure block size for a node, collecting its strings */
+static bool size_dt_node(const struct dt_node *node, size_t *size)
+{
+	const struct dt_node *i;
+	const struct dt_property *p;
+
+	*size += FDT_TAGSIZE + FDT_TAGALIGN(strlen(node->name) + 1);
+	*size += ARRAY_SIZE(fdt_phandle_names) * fdt_prop_size(sizeof(u32));
+
+	list_for_each(&node->properties, p, list) {
+		if (strstarts(p->name, DT_PRIVATE))
+			continue;
+		if (fdt_string_add(p->name) < 0)
+			return false;
+		*size += fdt_prop_size(p->len);
+	}
+
+	list_for_each(&node->children, i, list)
+		if (!size_dt_node(i, size))
+			return false;
+
+	*size += FDT_TAGSIZE;
+	return true;
 }
 
-static void dt_property(const char *name, const void *val, size_t size)
+static void *flatten_u32(void *p, u32 val)
 {
-	save_err(fdt_property(fdt, name, val, size));
+	*(uint32_t *)p = cpu_to_fdt32(val);
+	return p + sizeof(uint32_t);
 }
 
-static void dt_end_node(void)
+static void *flatten_prop(void *p, const char *name, const void *val,
+			  size_t len)
 {
-	save_err(fdt_end_node(fdt));
+	struct fdt_property *prop = p;
+
+	prop->tag = cpu_to_fdt32(FDT_PROP);
+	prop->len = cpu_to_fdt32(len);
+	prop->nameoff = cpu_to_fdt32(fdt_string_offset(name));
+	memcpy(prop->data, val, len);
+	memset(prop->data + len, 0, FDT_TAGALIGN(len) - len);
+	return p + fdt_prop_size(len);
+}
+
+static void *flatten_dt_node(void *p, const struct dt_node *node)
+{
+	const struct dt_node *i;
+	const struct dt_property *p2;
+	uint32_t phandle = cpu_to_fdt32(node->phandle);
+	size_t len = strlen(node->name) + 1;
+	unsigned int n;
+
+#ifdef DEBUG_FDT
+	printf("FDT: node: %s\n", node->name);
+#endif
+	p = flatten_u32(p, FDT_BEGIN_NODE);
+	memcpy(p, node->name, len);
+	memset(p + len, 0, FDT_TAGALIGN(len) - len);
+	p += FDT_TAGALIGN(len);
+
+	/*
+	 * We add both the new style "phandle" and the legacy
+	 * "linux,phandle" properties
+	 */
+	for (n = 0; n < ARRAY_SIZE(fdt_phandle_names); n++)
+		p = flatten_prop(p, fdt_phandle_names[n], &phandle,
+				 sizeof(phandle));
+
+	list_for_each(&node->properties, p2, list) {
+		if (strstarts(p2->name, DT_PRIVATE))
+			continue;
+#ifdef DEBUG_FDT
+		printf("FDT:   prop: %s size: %ld\n", p2->name, p2->len);
+#endif
+		p = flatten_prop(p, p2->name, p2->prop, p2->len);
+	}
+
+	list_for_each(&node->children, i, list)
+		p = flatten_dt_node(p, i);
+
+	return flatten_u32(p, FDT_END_NODE);
 }
 
 static void dump_fdt(void)
@@ -114,95 +256,71 @@ static void dump_fdt(void)
 #endif
 }
 
-static void flatten_dt_node(const struct dt_node *root)
-{
-	const struct dt_node *i;
-	const struct dt_property *p;
-
-#ifdef DEBUG_FDT
-	printf("FDT: node: %s\n", root->name);
-#endif
-
-	list_for_each(&root->properties, p, list) {
-		if (strstarts(p->name, DT_PRIVATE))
-			continue;
-#ifdef DEBUG_FDT
-		printf("FDT:   prop: %s size: %ld\n", p->name, p->len);
-#endif
-		dt_property(p->name, p->prop, p->len);
-	}
-
-	list_for_each(&root->children, i, list) {
-		dt_begin_node(i->name, i->phandle);
-		flatten_dt_node(i);
-		dt_end_node();
-	}
-}
-
-static void create_dtb_reservemap(const struct dt_node *root)
+void *create_dtb(const struct dt_node *root)
 {
-	uint64_t base, size;
-	const uint64_t *ranges;
-	const struct dt_property *prop;
-	int i;
+	const struct dt_property *ranges;
+	struct fdt_reserve_entry *re;
+	size_t rsv_off, struct_off, strings_off, len, i, struct_size = 0;
+	unsigned int nr_rsv = 0;
+	const u64 *range;
+	void *end;
+
+	/* Sizing pass */
+	ranges = dt_find_property(root, "reserved-ranges");
+	if (ranges)
+		nr_rsv = ranges->len / (sizeof(u64) * 2);
+	for (i = 0; i < ARRAY_SIZE(fdt_phandle_names); i++)
+		if (fdt_string_add(fdt_phandle_names[i]) < 0)
+			goto nomem;
+	if (!size_dt_node(root, &struct_size))
+		goto nomem;
+	struct_size += FDT_TAGSIZE;
+
+	rsv_off = FDT_ALIGN(sizeof(struct fdt_header),
+			    sizeof(struct fdt_reserve_entry));
+	struct_off = rsv_off + (nr_rsv + 1) * sizeof(struct fdt_reserve_entry);
+	strings_off = struct_off + struct_size;
+	len = strings_off + fdt_strings.len;
+
+	free(fdt);
+	fdt = zalloc(len);
+	if (!fdt)
+		goto nomem;
+
+	fdt_set_magic(fdt, FDT_MAGIC);
+	fdt_set_totalsize(fdt, len);
+	fdt_set_off_dt_struct(fdt, struct_off);
+	fdt_set_off_dt_strings(fdt, strings_off);
+	fdt_set_off_mem_rsvmap(fdt, rsv_off);
+	fdt_set_version(fdt, FDT_LAST_SUPPORTED_VERSION);
+	fdt_set_last_comp_version(fdt, FDT_FIRST_SUPPORTED_VERSION);
+	fdt_set_size_dt_strings(fdt, fdt_strings.len);
+	fdt_set_size_dt_struct(fdt, struct_size);
 
 	/* Duplicate the reserved-ranges property into the fdt reservemap */
-	prop = dt_find_property(root, "reserved-ranges");
-	if (prop) {
-		ranges = (const void *)prop->prop;
-
-		for (i = 0; i < prop->len / (sizeof(uint64_t) * 2); i++) {
-			base = *(ranges++);
-			size = *(ranges++);
-			save_err(fdt_add_reservemap_entry(fdt, base, size));
-		}
+	re = fdt + rsv_off;
+	range = ranges ? (const void *)ranges->prop : NULL;
+	for (i = 0; i < nr_rsv; i++, re++) {
+		re->address = cpu_to_fdt64(*(range++));
+		re->size = cpu_to_fdt64(*(range++));
 	}
 
-	save_err(fdt_finish_reservemap(fdt));
-}
+	/* Flatten our live tree */
+	end = flatten_dt_node(fdt + struct_off, root);
+	end = flatten_u32(end, FDT_END);
+	assert(end == fdt + strings_off);
 
-void *create_dtb(const struct dt_node *root)
-{
-	size_t len = DEVICE_TREE_MAX_SIZE;
-	uint32_t old_last_phandle = last_phandle;
-
-	do {
-		if (fdt)
-			free(fdt);
-		last_phandle = old_last_phandle;
-		fdt_error = 0;
-		fdt = malloc(len);
-		if (!fdt) {
-			prerror("dtb: could not malloc %lu\n", (long)len);
-			return NULL;
-		}
-
-		fdt_create(fdt, len);
-
-		create_dtb_reservemap(root);
-
-		/* Open root node */
-		dt_begin_node(root->name, root->phandle);
-
-		/* Unflatten our live tree */
-		flatten_dt_node(root);
-
-		/* Close root node */
-		dt_end_node();
-
-		save_err(fdt_finish(fdt));
-
-		if (!fdt_error)
-			break;
-
-		len *= 2;
-	} while (fdt_error == -FDT_ERR_NOSPACE);
+	for (i = 0; i < fdt_strings.size; i++)
+		if (fdt_strings.names[i])
+			strcpy(fdt + strings_off + fdt_strings.offsets[i],
+			       fdt_strings.names[i]);
+	fdt_strings_free();
 
 	dump_fdt();
-
-	if (fdt_error) {
-		prerror("dtb: error %s\n", fdt_strerror(fdt_error));
-		return NULL;
-	}
 	return fdt;
+
+ nomem:
+	fdt_strings_free();
+	prerror("dtb: could not allocate device tree blob\n");
+	return NULL;
 }
@@ -42,6 +42,9 @@
 #include <centaur.h>
 #include <libfdt/libfdt.h>
 #include <hostservices.h>
+#include <timebase.h>
+#include <boot-timeline.h>
+#include <slab.h>
 
 /*
  * Boot semaphore, incremented by each CPU calling in
@@ -268,6 +271,121 @@ extern char __builtin_kernel_start[];
 extern char __builtin_kernel_end[];
 extern uint64_t boot_offset;
 
+/*
+ * On FSP machines the kernel LID is fetched in the background as soon
+ * as the FSP is up, while the rest of the boot goes on. It lands in
+ * KERNEL_LOAD_BASE, which is part of the OS reserve so nothing else
+ * lives there, one PSI_DMA_KERNEL_FETCH window at a time. The FSP
+ * completions chain the chunks, and load_kernel() waits for the last
+ * one. If anything went wrong it falls back to fetching synchronously.
+ */
+static struct {
+	bool		started;
+	bool		done;
+	bool		ok;
+	bool		opal_only;
+	bool		phyp;
+	uint32_t	lid;
+	uint32_t	offset;		/* Bytes fetched so far */
+	uint32_t	chunk;		/* Size of the request in flight */
+	int		ev;
+} kernel_fetch;
+
+static void kernel_fetch_finish(bool ok)
+{
+	boot_timeline_end(kernel_fetch.ev);
+	kernel_fetch.ok = ok;
+	lwsync();
+	kernel_fetch.done = true;
+}
+
+static void kernel_fetch_complete(struct fsp_msg *msg);
+
+static void kernel_fetch_next(void)
+{
+	size_t chunk = KERNEL_LOAD_SIZE - kernel_fetch.offset;
+
+	if (chunk > PSI_DMA_KERNEL_FETCH_SZ)
+		chunk = PSI_DMA_KERNEL_FETCH_SZ;
+	kernel_fetch.chunk = chunk;
+
+	fsp_tce_map(PSI_DMA_KERNEL_FETCH, KERNEL_LOAD_BASE + kernel_fetch.offset,
+		    chunk);
+	if (fsp_fetch_data_queue(0, FSP_DATASET_NONSP_LID, kernel_fetch.lid,
+				 kernel_fetch.offset,
+				 (void *)PSI_DMA_KERNEL_FETCH, &chunk,
+				 kernel_fetch_complete)) {
+		fsp_tce_unmap(PSI_DMA_KERNEL_FETCH, kernel_fetch.chunk);
+		kernel_fetch_finish(false);
+	}
+}
+
+static void kernel_fetch_complete(struct fsp_msg *msg)
+{
+	uint8_t status = (msg->resp->word1 >> 8) & 0xff;
+	uint32_t len = msg->resp->data.words[2];
+
+	fsp_freemsg(msg);
+	fsp_tce_unmap(PSI_DMA_KERNEL_FETCH, kernel_fetch.chunk);
+
+	/* Same rules as fsp_fetch_data() */
+	if (status != FSP_STATUS_SUCCESS && status != FSP_STATUS_MORE_DATA) {
+		if (kernel_fetch.opal_only || kernel_fetch.phyp) {
+			prerror("INIT: Background kernel fetch failed,"
+				" status 0x%02x\n", status);
+			kernel_fetch_finish(false);
+			return;
+		}
+		printf("INIT: No OPAL secondary LID, fetching PHYP LID...\n");
+		kernel_fetch.phyp = true;
+		kernel_fetch.lid = fsp_adjust_lid_side(KERNEL_LID_PHYP);
+		kernel_fetch.offset = 0;
+		kernel_fetch_next();
+		return;
+	}
+
+	kernel_fetch.offset += len;
+	if (len < kernel_fetch.chunk || kernel_fetch.offset >= KERNEL_LOAD_SIZE)
+		kernel_fetch_finish(true);
+	else
+		kernel_fetch_next();
+}
+
+static void kernel_fetch_start(void)
+{
+	const char *ltype = dt_prop_get_def(dt_root, "lid-type", NULL);
+
+	/* Without lid-type, the kernel is preloaded or built-in */
+	if (!ltype || !fsp_present())
+		return;
+
+	printf("INIT: Fetching the kernel in the background...\n");
+	kernel_fetch.started = true;
+	kernel_fetch.opal_only = !strcmp(ltype, "opal");
+	kernel_fetch.lid = fsp_adjust_lid_side(KERNEL_LID_OPAL);
+	kernel_fetch.ev = boot_timeline_start("kernel-dma", BOOT_EVENT_NO_ID);
+	kernel_fetch_next();
+}
+
+/* Join the background fetch, false if there's nothing usable */
+static bool kernel_fetch_wait(size_t *ksize)
+{
+	if (!kernel_fetch.started)
+		return false;
+
+	/* It's only good once, a fast reboot fetches again */
+	kernel_fetch.started = false;
+
+	while (!*(volatile bool *)&kernel_fetch.done)
+		fsp_poll();
+	lwsync();
+
+	if (!kernel_fetch.ok)
+		return false;
+	*ksize = kernel_fetch.offset;
+	return true;
+}
+
 static bool load_kernel(void)
 {
 	struct elf_hdr *kh;
@@ -292,6 +410,8 @@ static bool load_kernel(void)
 			memmove(KERNEL_LOAD_BASE, (void*)builtin_base, ksize);
 		} else
 			printf("Assuming kernel at 0x%p\n", KERNEL_LOAD_BASE);
+	} else if (kernel_fetch_wait(&ksize)) {
+		printf("INIT: Kernel was fetched in the background\n");
 	} else {
 		ksize = KERNEL_LOAD_SIZE;
 
@@ -332,6 +452,10 @@ void __noreturn load_and_boot_kernel(bool is_reboot)
 {
 	const struct dt_property *memprop;
 	uint64_t mem_top;
+	int ph;
+
+	/* Boot is mostly done allocating, return what we cached */
+	slab_drain();
 
 	memprop = dt_find_property(dt_root, DT_PRIVATE "maxmem");
 	if (memprop)
@@ -343,12 +467,15 @@ void __noreturn load_and_boot_kernel(bool is_reboot)
 	op_display(OP_LOG, OP_MOD_INIT, 0x000A);
 
 	/* Load kernel LID */
+	ph = boot_timeline_start("kernel-load", BOOT_EVENT_NO_ID);
 	if (!load_kernel()) {
 		op_display(OP_FATAL, OP_MOD_INIT, 1);
 		abort();
 	}
 
 	if (!is_reboot) {
+		ph = boot_timeline_next(ph, "nvram-vpd-wait");
+
 		/* We wait for the nvram read to complete here so we can
 		 * grab stuff from there such as the kernel arguments
 		 */
@@ -363,6 +490,7 @@ void __noreturn load_and_boot_kernel(bool is_reboot)
 	 * OCC takes few secs to boot.  Call this as late as
 	 * as possible to avoid delay.
 	 */
+	ph = boot_timeline_next(ph, "occ-pstates");
 	occ_pstates_init();
 
 	/* Set kernel command line argument if specified */
@@ -373,12 +501,15 @@ void __noreturn load_and_boot_kernel(bool is_reboot)
 	op_display(OP_LOG, OP_MOD_INIT, 0x000B);
 
 	/* Create the device tree blob to boot OS. */
+	ph = boot_timeline_next(ph, "flatten-dt");
 	fdt = create_dtb(dt_root);
 	if (!fdt) {
 		op_display(OP_FATAL, OP_MOD_INIT, 2);
 		abort();
 	}
 
+	boot_timeline_end(ph);
+
 	op_display(OP_LOG, OP_MOD_INIT, 0x000C);
 
 	/* Start the kernel */
@@ -390,6 +521,11 @@ void __noreturn load_and_boot_kernel(bool is_reboot)
 
 	cpu_give_self_os();
 
+	/* The entry has no duration, it's where the OS takes over */
+	boot_timeline_end(boot_timeline_start("kernel-entry", BOOT_EVENT_NO_ID));
+	if (!is_reboot)
+		boot_timeline_print();
+
 	printf("INIT: Starting kernel at 0x%llx, fdt at %p (size 0x%x)\n",
 	       kernel_entry, fdt, fdt_totalsize(fdt));
 
@@ -461,11 +597,36 @@ static void dt_init_misc(void)
 	dt_fixups();
 }
 
+/*
+ * The tree expanded from the boot FDT still points into it, so keep the
+ * OS off the blob, unless it already sits in skiboot's own image or heap.
+ */
+static void reserve_boot_fdt(const void *fdt)
+{
+	uint64_t start = (uint64_t)fdt, end;
+	struct mem_region *r;
+
+	if (fdt_check_header(fdt) != 0)
+		return;
+	end = start + fdt_totalsize(fdt);
+
+	for (r = mem_region_next(NULL); r; r = mem_region_next(r)) {
+		if (r->start >= end || start >= r->start + r->len)
+			continue;
+		if (r == &skiboot_heap || r->type != REGION_SKIBOOT_HEAP)
+			return;
+	}
+	mem_reserve("ibm,boot-fdt", start, end - start);
+}
+
 /* Called from head.S, thus no prototype. */
 void main_cpu_entry(const void *fdt, u32 master_cpu);
 
 void __noreturn main_cpu_entry(const void *fdt, u32 master_cpu)
 {
+	unsigned long tb;
+	int ph;
+
 	/*
 	 * WARNING: At this point. the timebases have
 	 * *not* been synchronized yet. Do not use any timebase
@@ -495,6 +656,9 @@ void __noreturn main_cpu_entry(const void *fdt, u32 master_cpu)
 	/* Now locks can be used */
 	init_locks();
 
+	/* And so can the boot timeline */
+	ph = boot_timeline_start("opal-table", BOOT_EVENT_NO_ID);
+
 	/* Create the OPAL call table early on, entries can be overridden
 	 * later on (FSP console code for example)
 	 */
@@ -507,6 +671,8 @@ void __noreturn main_cpu_entry(const void *fdt, u32 master_cpu)
 	 * Hack alert: When entering via the OPAL entry point, fdt
 	 * is set to -1, we record that and pass it to parse_hdat
 	 */
+	ph = boot_timeline_next(ph, "device-tree");
+	dt_arena_begin();
 	if (fdt == (void *)-1ul)
 		parse_hdat(true, master_cpu);
 	else if (fdt == NULL)
@@ -514,6 +680,7 @@ void __noreturn main_cpu_entry(const void *fdt, u32 master_cpu)
 	else {
 		dt_expand(fdt);
 	}
+	dt_arena_end();
 
 	/*
 	 * From there, we follow a fairly strict initialization order.
@@ -527,6 +694,7 @@ void __noreturn main_cpu_entry(const void *fdt, u32 master_cpu)
 	 * We also initialize the FSI master at that point in case we need
 	 * to access chips via that path early on.
 	 */
+	ph = boot_timeline_next(ph, "xscom");
 	init_chips();
 	xscom_init();
 	mfsi_init();
@@ -536,6 +704,7 @@ void __noreturn main_cpu_entry(const void *fdt, u32 master_cpu)
 	 * already be there such as the /chosen node if not there yet,
 	 * the ICS node, etc... This can potentially use XSCOM
 	 */
+	ph = boot_timeline_next(ph, "dt-misc");
 	dt_init_misc();
 
 	/*
@@ -544,6 +713,7 @@ void __noreturn main_cpu_entry(const void *fdt, u32 master_cpu)
 	 * so that the platform probing code can access an external
 	 * BMC if needed.
 	 */
+	ph = boot_timeline_next(ph, "lpc");
 	lpc_init();
 
 	/*
@@ -553,12 +723,17 @@ void __noreturn main_cpu_entry(const void *fdt, u32 master_cpu)
 	 * allocations outside of our heap, such as chip local allocs,
 	 * otherwise we might clobber those data.
 	 */
+	ph = boot_timeline_next(ph, "mem-region");
 	mem_region_init();
+	if (fdt != NULL && fdt != (void *)-1ul)
+		reserve_boot_fdt(fdt);
 
 	/* Reserve HOMER and OCC area */
+	ph = boot_timeline_next(ph, "homer");
 	homer_init();
 
 	/* Initialize host services. */
+	ph = boot_timeline_next(ph, "hservices");
 	hservices_init();
 
 	/*
@@ -567,27 +742,35 @@ void __noreturn main_cpu_entry(const void *fdt, u32 master_cpu)
 	 *
 	 * Note: Timebases still not synchronized.
 	 */
+	ph = boot_timeline_next(ph, "probe-platform");
 	probe_platform();
 
 	/* Initialize the rest of the cpu thread structs */
+	ph = boot_timeline_next(ph, "init-cpus");
 	init_all_cpus();
 
 	/* Add the /opal node to the device-tree */
+	ph = boot_timeline_next(ph, "opal-node");
 	add_opal_node();
 
 	/* Allocate our split trace buffers now. Depends add_opal_node() */
+	ph = boot_timeline_next(ph, "trace");
 	init_trace_buffers();
 
 	/* Get the ICPs and make sure they are in a sane state */
+	ph = boot_timeline_next(ph, "interrupts");
 	init_interrupts();
 
 	/* Grab centaurs from device-tree if present (only on FSP-less) */
+	ph = boot_timeline_next(ph, "centaur");
 	centaur_init();
 
 	/* Initialize PSI (depends on probe_platform being called) */
+	ph = boot_timeline_next(ph, "psi");
 	psi_init();
 
 	/* Call in secondary CPUs */
+	ph = boot_timeline_next(ph, "cpu-bringup");
 	cpu_bringup();
 
 	/*
@@ -595,38 +778,56 @@ void __noreturn main_cpu_entry(const void *fdt, u32 master_cpu)
 	 * value (so they appear to go backward at this point), and synchronize
 	 * all core timebases to the global ChipTOD network
 	 */
+	ph = boot_timeline_next(ph, "chiptod");
+	tb = mftb();
 	chiptod_init(master_cpu);
+	boot_timeline_tb_sync(tb, mftb());
+
+	/* Timebases agree now, so cross-CPU timing makes sense */
+	cpu_job_latency_test();
 
 	/*
 	 * We have initialized the basic HW, we can now call into the
 	 * platform to perform subsequent inits, such as establishing
 	 * communication with the FSP.
 	 */
+	ph = boot_timeline_next(ph, "platform");
 	if (platform.init)
 		platform.init();
 
+	/* Get the kernel coming while we do the rest */
+	ph = boot_timeline_next(ph, "kernel-fetch");
+	kernel_fetch_start();
+
 	/* Init SLW related stuff, including fastsleep */
+	ph = boot_timeline_next(ph, "slw");
 	slw_init();
 
 	op_display(OP_LOG, OP_MOD_INIT, 0x0002);
 
 	/* Read in NVRAM and set it up */
+	ph = boot_timeline_next(ph, "nvram");
 	nvram_init();
 
 	/* NX init */
+	ph = boot_timeline_next(ph, "nx");
 	nx_init();
 
 	/* Initialize the opal messaging */
+	ph = boot_timeline_next(ph, "opal-msg");
 	opal_init_msg();
 
 	/* Probe IO hubs */
+	ph = boot_timeline_next(ph, "io-hubs");
 	probe_p5ioc2();
 	probe_p7ioc();
 
 	/* Probe PHB3 on P8 */
+	ph = boot_timeline_next(ph, "phb3");
 	probe_phb3();
 
 	/* Initialize PCI */
+	ph = boot_timeline_next(ph, "pci");
 	pci_init_slots();
 
 	/*
@@ -640,13 +841,17 @@ void __noreturn main_cpu_entry(const void *fdt, u32 master_cpu)
 	 */
 
 	/* Add the list of interrupts going to OPAL */
+	ph = boot_timeline_next(ph, "opal-irqs");
 	add_opal_interrupts();
 
 	/* Now release parts of memory nodes we haven't used ourselves... */
+	ph = boot_timeline_next(ph, "mem-release");
 	mem_region_release_unused();
 
 	/* ... and add remaining reservations to the DT */
+	ph = boot_timeline_next(ph, "mem-reserve");
 	mem_region_add_dt_reserved();
+	boot_timeline_end(ph);
 
 	load_and_boot_kernel(false);
 }
@@ -660,16 +865,11 @@ void __noreturn __secondary_cpu_entry(void)
 
 	/* Wait for work to do */
 	while(true) {
-		int i;
-
 		/* Process pending jobs on this processor */
 		cpu_process_jobs();
 
-		/* Relax a bit to give the simulator some breathing space */
-		i = 1000;
-		while (--i)
-			smt_very_low();
-		smt_low();
+		/* Then wait for more */
+		cpu_idle();
 	}
 }
 
@@ -38,7 +38,7 @@ struct irq_source {
 };
 
 static LIST_HEAD(irq_sources);
-static struct lock irq_lock = LOCK_UNLOCKED;
+static struct rwlock irq_lock = RWLOCK_UNLOCKED;
 
 void register_irq_source(const struct irq_source_ops *ops, void *data,
 			 uint32_t start, uint32_t count)
@@ -56,7 +56,7 @@ void register_irq_source(const struct irq_source_ops *ops, void *data,
 	       start, start + count - 1, ops, data,
 	       ops->interrupt ? "[Internal]" : "[OS]");
 
-	lock(&irq_lock);
+	write_lock(&irq_lock);
 	list_for_each(&irq_sources, is1, link) {
 		if (is->end > is1->start && is->start < is1->end) {
 			prerror("register IRQ source overlap !\n");
@@ -67,14 +67,14 @@ void register_irq_source(const struct irq_source_ops *ops, void *data,
 		}
 	}
 	list_add_tail(&irq_sources, &is->link);
-	unlock(&irq_lock);
+	write_unlock(&irq_lock);
 }
 
 void unregister_irq_source(uint32_t start, uint32_t count)
 {
 	struct irq_source *is;
 
-	lock(&irq_lock);
+	write_lock(&irq_lock);
 	list_for_each(&irq_sources, is, link) {
 		if (start >= is->start && start < is->end) {
 			if (start != is->start ||
@@ -85,13 +85,13 @@ void unregister_irq_source(uint32_t start, uint32_t count)
 				assert(0);
 			}
 			list_del(&is->link);
-			unlock(&irq_lock);
+			write_unlock(&irq_lock);
 			/* XXX Add synchronize / RCU */
 			free(is);
 			return;
 		}
 	}
-	unlock(&irq_lock);
+	write_unlock(&irq_lock);
 	prerror("unregister IRQ source not found !\n");
 	prerror("start:%x, count: %x\n", start, count);
 	assert(0);
@@ -167,7 +167,7 @@ void add_opal_interrupts(void)
 	unsigned int i, count = 0;
 	uint32_t *irqs = NULL, isn;
 
-	lock(&irq_lock);
+	read_lock(&irq_lock);
 	list_for_each(&irq_sources, is, link) {
 		/*
 		 * Add a source to opal-interrupts if it has an
@@ -181,7 +181,7 @@ void add_opal_interrupts(void)
 			irqs[i] = isn;
 		}
 	}
-	unlock(&irq_lock);
+	read_unlock(&irq_lock);
 
 	/* The opal-interrupts property has one cell per interrupt,
 	 * it is not a standard interrupt property
@@ -252,14 +252,14 @@ static struct irq_source *irq_find_source(uint32_t isn)
 {
 	struct irq_source *is;
 
-	lock(&irq_lock);
+	read_lock(&irq_lock);
 	list_for_each(&irq_sources, is, link) {
 		if (isn >= is->start && isn < is->end) {
-			unlock(&irq_lock);
+			read_unlock(&irq_lock);
 			return is;
 		}
 	}
-	unlock(&irq_lock);
+	read_unlock(&irq_lock);
 
 	return NULL;
 }
@@ -20,6 +20,10 @@
 #include <processor.h>
 #include <cpu.h>
 #include <console.h>
+#include <timebase.h>
+#include <string.h>
+#include <mem_region.h>
+#include <pci.h>
 
 /* Set to bust locks. Note, this is initialized to true because our
  * lock debugging code is not going to work until we have the per
@@ -27,17 +31,25 @@
  */
 bool bust_locks = true;
 
-#ifdef DEBUG_LOCKS
+static struct lock_stats lock_stats = {
+	.max_entries	= LOCK_STATS_ENTRIES,
+};
+static struct lock lock_stats_lock = LOCK_UNLOCKED;
 
 static void lock_error(struct lock *l, const char *reason, uint16_t err)
 {
+	/* Printing takes the console lock */
+	bust_locks = true;
+
 	op_display(OP_FATAL, OP_MOD_LOCK, err);
 
-	fprintf(stderr, "LOCK ERROR: %s @%p (state: 0x%016lx)\n",
-		reason, l, l->lock_val);
+	fprintf(stderr, "LOCK ERROR: %s @%p %s (state: 0x%016lx)\n",
+		reason, l, l->stats ? l->stats->name : "", l->lock_val);
 	abort();
 }
 
+#ifdef DEBUG_LOCKS
+
 static void lock_check(struct lock *l)
 {
 	if ((l->lock_val & 1) && (l->lock_val >> 32) == this_cpu()->pir)
@@ -61,42 +73,195 @@ static inline void lock_check(struct lock *l) { };
 static inline void unlock_check(struct lock *l) { };
 #endif /* DEBUG_LOCKS */
 
+#ifdef LOCK_STATS
+
+static inline unsigned long lock_stats_start(struct lock *l)
+{
+	return l->stats ? mftb() : 0;
+}
+
+/* Called by the new owner */
+static void lock_stats_taken(struct lock *l, unsigned long start,
+			     bool contended)
+{
+	struct lock_stat *s = l->stats;
+	unsigned long now, spin;
+
+	if (!s)
+		return;
+
+	now = mftb();
+	s->acquires++;
+	if (contended) {
+		spin = now - start;
+		s->contended++;
+		s->spin_total += spin;
+		if (spin > s->spin_max)
+			s->spin_max = spin;
+	}
+	l->hold_start = now;
+}
+
+/* Called by the owner before letting go */
+static void lock_stats_release(struct lock *l)
+{
+	struct lock_stat *s = l->stats;
+	unsigned long hold;
+
+	if (!s)
+		return;
+
+	hold = mftb() - l->hold_start;
+	if (hold > s->hold_max)
+		s->hold_max = hold;
+}
+
+#else
+static inline unsigned long lock_stats_start(struct lock *l __unused)
+{
+	return 0;
+}
+static inline void lock_stats_taken(struct lock *l __unused,
+				    unsigned long start __unused,
+				    bool contended __unused) { }
+static inline void lock_stats_release(struct lock *l __unused) { }
+#endif /* LOCK_STATS */
+
+/*
+ * The queue nodes are only ever touched by other CPUs through the
+ * next and wait fields, in_use is private to the owning CPU.
+ */
+static struct lock_qnode *get_qnode(struct lock *l, struct cpu_thread *cpu)
+{
+	struct lock_qnode *node;
+	unsigned int i;
+
+	for (i = 0; i < LOCK_MAX_NESTING; i++) {
+		node = &cpu->lock_nodes[i];
+		if (!node->in_use) {
+			node->in_use = true;
+			node->next = NULL;
+			node->wait = true;
+			return node;
+		}
+	}
+	lock_error(l, "Too many nested locks", 4);
+	return NULL;
+}
+
+static void put_qnode(struct lock_qnode *node)
+{
+	node->in_use = false;
+}
+
+static inline struct lock_qnode *qnode_next(struct lock_qnode *node)
+{
+	return *(struct lock_qnode * volatile *)&node->next;
+}
+
+static inline bool qnode_waiting(struct lock_qnode *node)
+{
+	return *(volatile bool *)&node->wait;
+}
+
+/* Called with the lock acquired through node */
+static void lock_taken(struct lock *l, struct cpu_thread *cpu,
+		       struct lock_qnode *node)
+{
+	/* lock() is a full barrier */
+	sync();
+
+	l->owner = node;
+	l->lock_val = ((unsigned long)cpu->pir << 32) | 1;
+
+	if (l->in_con_path)
+		cpu->con_suspend++;
+}
 
 bool try_lock(struct lock *l)
 {
-	if (__try_lock(l)) {
-		if (l->in_con_path)
-			this_cpu()->con_suspend++;
-		return true;
+	struct cpu_thread *cpu = this_cpu();
+	struct lock_qnode *node;
+
+	/* Don't bother queueing if someone has it */
+	if (l->tail)
+		return false;
+
+	node = get_qnode(l, cpu);
+	lwsync();
+	if (__lock_cmpxchg((unsigned long *)&l->tail, 0,
+			   (unsigned long)node) != 0) {
+		put_qnode(node);
+		return false;
 	}
-	return false;
+	lock_taken(l, cpu, node);
+	lock_stats_taken(l, 0, false);
+	return true;
 }
 
 void lock(struct lock *l)
 {
+	struct cpu_thread *cpu;
+	struct lock_qnode *node, *prev;
+	unsigned long start;
+
 	if (bust_locks)
 		return;
 
 	lock_check(l);
-	for (;;) {
-		if (try_lock(l))
-			break;
-		smt_low();
+	start = lock_stats_start(l);
+
+	cpu = this_cpu();
+	node = get_qnode(l, cpu);
+
+	/* Our node must be initialized before anybody can see it */
+	lwsync();
+	prev = (struct lock_qnode *)__lock_xchg((unsigned long *)&l->tail,
+						(unsigned long)node);
+	if (prev) {
+		/* Queue behind prev and wait for it to hand over */
+		prev->next = node;
+		while (qnode_waiting(node))
+			smt_low();
+		smt_medium();
 	}
-	smt_medium();
+	lock_taken(l, cpu, node);
+	lock_stats_taken(l, start, prev != NULL);
 }
 
 void unlock(struct lock *l)
 {
 	struct cpu_thread *cpu = this_cpu();
+	struct lock_qnode *node, *next;
 
 	if (bust_locks)
 		return;
 
 	unlock_check(l);
+	lock_stats_release(l);
 
-	lwsync();
+	node = l->owner;
+	l->owner = NULL;
 	l->lock_val = 0;
+	lwsync();
+
+	/*
+	 * Nobody queued behind us: release it. Otherwise someone is
+	 * queueing, wait until they have linked themselves after us.
+	 */
+	next = qnode_next(node);
+	if (!next) {
+		if (__lock_cmpxchg((unsigned long *)&l->tail,
+				   (unsigned long)node, 0)
+		    == (unsigned long)node)
+			goto out;
+		while (!(next = qnode_next(node)))
+			smt_low();
+		smt_medium();
+	}
+	next->wait = false;
+ out:
+	put_qnode(node);
 
 	if (l->in_con_path) {
 		cpu->con_suspend--;
@@ -119,7 +284,113 @@ bool lock_recursive(struct lock *l)
 }
 
 
+static inline unsigned long rwlock_val(struct rwlock *rw)
+{
+	return *(volatile unsigned long *)&rw->val;
+}
+
+void read_lock(struct rwlock *rw)
+{
+	unsigned long val;
+	bool spun = false;
+
+	if (bust_locks)
+		return;
+
+	for (;;) {
+		val = rwlock_val(rw);
+		if (!(val & RWLOCK_WRITER) &&
+		    __lock_cmpxchg(&rw->val, val, val + 1) == val)
+			break;
+		smt_low();
+		spun = true;
+	}
+	if (spun)
+		smt_medium();
+	isync();
+}
+
+void read_unlock(struct rwlock *rw)
+{
+	unsigned long val;
+
+	if (bust_locks)
+		return;
+
+	lwsync();
+	do {
+		val = rwlock_val(rw);
+		if (!(val & ~RWLOCK_WRITER))
+			lock_error(&rw->wlock, "Read unlocking unlocked lock",
+				   5);
+	} while (__lock_cmpxchg(&rw->val, val, val - 1) != val);
+}
+
+void write_lock(struct rwlock *rw)
+{
+	unsigned long val;
+
+	if (bust_locks)
+		return;
+
+	/* Other writers queue here */
+	lock(&rw->wlock);
+
+	/* Keep new readers out, then wait for the others to leave */
+	do {
+		val = rwlock_val(rw);
+	} while (__lock_cmpxchg(&rw->val, val, val | RWLOCK_WRITER) != val);
+
+	if (val) {
+		while (rwlock_val(rw) != RWLOCK_WRITER)
+			smt_low();
+		smt_medium();
+	}
+	sync();
+}
+
+void write_unlock(struct rwlock *rw)
+{
+	if (bust_locks)
+		return;
+
+	lwsync();
+	rw->val = 0;
+	unlock(&rw->wlock);
+}
+
+void lock_set_name(struct lock *l, const char *name)
+{
+	struct lock_stat *s;
+
+	lock(&lock_stats_lock);
+	if (lock_stats.num_entries >= LOCK_STATS_ENTRIES) {
+		unlock(&lock_stats_lock);
+		prerror("LOCK: Statistics table full, not tracking %s\n", name);
+		return;
+	}
+	s = &lock_stats.entries[lock_stats.num_entries];
+	memset(s, 0, sizeof(*s));
+	strncpy(s->name, name, LOCK_NAME_LEN - 1);
+
+	/* Host readers check num_entries first */
+	lwsync();
+	lock_stats.num_entries++;
+	unlock(&lock_stats_lock);
+
+	/* Under the lock so an owner doesn't see half of it */
+	lock(l);
+	l->hold_start = mftb();
+	l->stats = s;
+	unlock(l);
+}
+
 void init_locks(void)
 {
+	debug_descriptor.lock_stats_phys = (uint64_t)&lock_stats;
+	lock_set_name(&con_lock, "console");
+	lock_set_name(&mem_region_lock, "mem_region");
+	lock_set_name(&pci_lock, "pci");
+
 	bust_locks = false;
 }
@@ -23,13 +23,7 @@
 
 void *__memalign(size_t blocksize, size_t bytes, const char *location)
 {
-	void *p;
-
-	lock(&mem_region_lock);
-	p = mem_alloc(&skiboot_heap, bytes, blocksize, location);
-	unlock(&mem_region_lock);
-
-	return p;
+	return mem_heap_alloc(bytes, blocksize, location);
 }
 
 void *__malloc(size_t bytes, const char *location)
@@ -39,9 +33,7 @@ void *__malloc(size_t bytes, const char *location)
 
 void __free(void *p, const char *location)
 {
-	lock(&mem_region_lock);
-	mem_free(&skiboot_heap, p, location);
-	unlock(&mem_region_lock);
+	mem_heap_free(p, location);
 }
 
 void *__realloc(void *ptr, size_t size, const char *location)
@@ -56,21 +48,20 @@ void *__realloc(void *ptr, size_t size, const char *location)
 	if (!ptr)
 		return __malloc(size, location);
 
-	lock(&mem_region_lock);
-	if (mem_resize(&skiboot_heap, ptr, size, location)) {
-		newptr = ptr;
-	} else {
-		newptr = mem_alloc(&skiboot_heap, size, DEFAULT_ALIGN,
-				   location);
-		if (newptr) {
-			size_t copy = mem_size(&skiboot_heap, ptr);
-			if (copy > size)
-				copy = size;
-			memcpy(newptr, ptr, copy);
-			mem_free(&skiboot_heap, ptr, location);
-		}
+	if (mem_heap_resize(ptr, size, location))
+		return ptr;
+
+	/* We can't hold the heap lock across this as the new block may
+	 * come from another chip's heap.
+	 */
+	newptr = mem_heap_alloc(size, DEFAULT_ALIGN, location);
+	if (newptr) {
+		size_t copy = mem_heap_size(ptr);
+		if (copy > size)
+			copy = size;
+		memcpy(newptr, ptr, copy);
+		mem_heap_free(ptr, location);
 	}
-	unlock(&mem_region_lock);
 	return newptr;
 }
 
@@ -21,6 +21,7 @@
 #include <device.h>
 #include <cpu.h>
 #include <affinity.h>
+#include <chip.h>
 #include <types.h>
 #include <mem_region.h>
 #include <mem_region-malloc.h>
@@ -34,6 +35,12 @@ struct lock mem_region_lock = LOCK_UNLOCKED;
 
 static struct list_head regions = LIST_HEAD_INIT(regions);
 
+/* Accounting for skiboot_heap and every other region under mem_region_lock */
+static struct heap_stats skiboot_heap_stats = {
+	.num_entries	= HEAP_STATS_ENTRIES,
+	.num_buckets	= HEAP_STATS_BUCKETS,
+};
+
 static struct mem_region skiboot_os_reserve = {
 	.name		= "ibm,os-reserve",
 	.start		= 0,
@@ -46,6 +53,7 @@ struct mem_region skiboot_heap = {
 	.start		= HEAP_BASE,
 	.len		= HEAP_SIZE,
 	.type		= REGION_SKIBOOT_HEAP,
+	.stats		= &skiboot_heap_stats,
 };
 
 static struct mem_region skiboot_code_and_text = {
@@ -69,6 +77,18 @@ static struct mem_region skiboot_cpu_stacks = {
 	.type		= REGION_SKIBOOT_FIRMWARE,
 };
 
+/*
+ * Per-chip heaps. These are carved out of the chip's memory node
+ * region (so they remain reserved from the OS as part of it) and are
+ * not on the regions list themselves. Each has its own lock.
+ */
+struct chip_heap {
+	struct mem_region	region;
+	struct lock		lock;
+};
+
+static struct chip_heap *chip_heaps[MAX_CHIPS];
+
 struct alloc_hdr {
 	bool free : 1;
 	bool prev_free : 1;
@@ -109,17 +129,55 @@ static struct alloc_hdr *next_hdr(const struct mem_region *region,
 	return next;
 }
 
+/* Free lists are only set up on first allocation from a region. */
+static bool region_initialized(const struct mem_region *region)
+{
+	return region->free_list[0].n.next != NULL;
+}
+
+/* Which free list does a block of this many longs belong on? */
+static unsigned int size_to_bin(unsigned long longs)
+{
+	unsigned int bin = BITS_PER_LONG - 1 - __builtin_clzl(longs);
+
+	if (bin >= MEM_REGION_FREE_BINS)
+		bin = MEM_REGION_FREE_BINS - 1;
+	return bin;
+}
+
+/* The size must not change while the block is on a free list! */
+static void free_list_add(struct mem_region *region, struct free_hdr *f)
+{
+	unsigned int bin = size_to_bin(f->hdr.num_longs);
+
+	list_add(&region->free_list[bin], &f->list);
+	region->free_list_map |= 1UL << bin;
+}
+
+static void free_list_del(struct mem_region *region, struct free_hdr *f)
+{
+	unsigned int bin = size_to_bin(f->hdr.num_longs);
+
+	list_del_from(&region->free_list[bin], &f->list);
+	if (list_empty(&region->free_list[bin]))
+		region->free_list_map &= ~(1UL << bin);
+}
+
 /* Creates free block covering entire region. */
 static void init_allocatable_region(struct mem_region *region)
 {
 	struct free_hdr *f = region_start(region);
+	unsigned int i;
+
 	assert(region->type == REGION_SKIBOOT_HEAP);
 	f->hdr.num_longs = region->len / sizeof(long);
 	f->hdr.free = true;
 	f->hdr.prev_free = false;
 	*tailer(f) = f->hdr.num_longs;
-	list_head_init(&region->free_list);
-	list_add(&region->free_list, &f->list);
+	for (i = 0; i < MEM_REGION_FREE_BINS; i++)
+		list_head_init(&region->free_list[i]);
+	region->free_list_map = 0;
+	free_list_add(region, f);
 }
 
 static void make_free(struct mem_region *region, struct free_hdr *f,
@@ -145,14 +203,16 @@ static void make_free(struct mem_region *region, struct free_hdr *f,
 		assert(prev->hdr.free);
 		assert(!prev->hdr.prev_free);
 
-		/* Expand to cover the one we just freed. */
+		/* Expand to cover the one we just freed: this may move
+		 * it to another size class. */
+		free_list_del(region, prev);
 		prev->hdr.num_longs += f->hdr.num_longs;
 		f = prev;
 	} else {
 		f->hdr.free = true;
 		f->hdr.location = location;
-		list_add(&region->free_list, &f->list);
 	}
+	free_list_add(region, f);
 
 	/* Fix up tailer. */
 	*tailer(f) = f->hdr.num_longs;
@@ -163,7 +223,7 @@ static void make_free(struct mem_region *region, struct free_hdr *f,
 		next->prev_free = true;
 		if (next->free) {
 			struct free_hdr *next_free = (void *)next;
-			list_del_from(&region->free_list, &next_free->list);
+			free_list_del(region, next_free);
 			/* Maximum of one level of recursion */
 			make_free(region, next_free, location);
 		}
@@ -173,23 +233,59 @@ static void make_free(struct mem_region *region, struct free_hdr *f,
 /* Can we fit this many longs with this alignment in this free block? */
 static bool fits(struct free_hdr *f, size_t longs, size_t align, size_t *offset)
 {
+	unsigned long addr;
+
+	addr = (unsigned long)f + ALLOC_HDR_LONGS * sizeof(long);
 	*offset = 0;
 
-	while (f->hdr.num_longs >= *offset + longs) {
-		size_t addr;
+	/* Don't make tiny chunks! */
+	if (addr & (align - 1))
+		*offset = (ALIGN_UP(addr + ALLOC_MIN_LONGS * sizeof(long), align)
+			   - addr) / sizeof(long);
 
-		addr = (unsigned long)f
-			+ (*offset + ALLOC_HDR_LONGS) * sizeof(long);
-		if ((addr & (align - 1)) == 0)
-			return true;
+	return f->hdr.num_longs >= *offset + longs;
+}
 
-		/* Don't make tiny chunks! */
-		if (*offset == 0)
-			*offset = ALLOC_MIN_LONGS;
-		else
-			(*offset)++;
+/*
+ * Find a free block for this many longs with this alignment.
+ *
+ * Any block in a size class above that of the worst case (including
+ * the alignment slop) is guaranteed to fit, so we take the first block
+ * of the smallest such non-empty class straight from the bitmap. Only
+ * if there is none do we search the classes which might still hold a
+ * block big enough.
+ */
+static struct free_hdr *find_free(struct mem_region *region, size_t longs,
+				  size_t align, size_t *offset)
+{
+	unsigned int bin, last_bin;
+	unsigned long map = 0;
+	struct free_hdr *f;
+	size_t worst = longs;
+
+	if (align > sizeof(long))
+		worst += align / sizeof(long) + ALLOC_MIN_LONGS;
+	last_bin = size_to_bin(worst);
+
+	if (last_bin + 1 < MEM_REGION_FREE_BINS)
+		map = region->free_list_map & ~((1UL << (last_bin + 1)) - 1);
+	if (map) {
+		bin = __builtin_ctzl(map);
+		f = list_top(&region->free_list[bin], struct free_hdr, list);
+		if (fits(f, longs, align, offset))
+			return f;
 	}
-	return false;
+
+	for (bin = size_to_bin(longs); bin <= last_bin; bin++) {
+		if (!(region->free_list_map & (1UL << bin)))
+			continue;
+		list_for_each(&region->free_list[bin], f, list) {
+			/* We may have to skip some to meet alignment. */
+			if (fits(f, longs, align, offset))
+				return f;
+		}
+	}
+	return NULL;
 }
 
 static void discard_excess(struct mem_region *region,
@@ -213,6 +309,101 @@ static void discard_excess(struct mem_region *region,
 	}
 }
 
+static void heap_stats_init(struct heap_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	stats->num_entries = HEAP_STATS_ENTRIES;
+	stats->num_buckets = HEAP_STATS_BUCKETS;
+}
+
+static void heap_stats_add_desc(struct heap_stats *stats)
+{
+	unsigned int i = debug_descriptor.num_heap_stats;
+
+	if (i >= DEBUG_DESC_MAX_HEAP_STATS) {
+		prerror("MEM: Debug descriptor heap stats list full !\n");
+		return;
+	}
+	debug_descriptor.num_heap_stats++;
+	debug_descriptor.heap_stats_phys[i] = (uint64_t)stats;
+}
+
+/* Open addressing on the location pointer, which is a constant */
+static struct heap_stat *heap_stat_find(struct heap_stats *stats,
+					const char *location)
+{
+	unsigned long hash = (unsigned long)location * 0x9e3779b97f4a7c15ul;
+	struct heap_stat *s;
+	unsigned int i;
+
+	for (i = 0; i < HEAP_STATS_ENTRIES; i++) {
+		s = &stats->entries[(hash + i) % HEAP_STATS_ENTRIES];
+		if (s->location == (unsigned long)location)
+			return s;
+		if (!s->location) {
+			s->location = (unsigned long)location;
+			return s;
+		}
+	}
+	return &stats->overflow;
+}
+
+static void heap_stat_add(struct heap_stat *s, size_t bytes)
+{
+	s->cur_bytes += bytes;
+	if (s->cur_bytes > s->peak_bytes)
+		s->peak_bytes = s->cur_bytes;
+}
+
+static void heap_stat_alloc(struct mem_region *region,
+			    const struct alloc_hdr *hdr, size_t size)
+{
+	struct heap_stat *s;
+	unsigned int bucket = 0;
+
+	if (!region->stats)
+		return;
+
+	s = heap_stat_find(region->stats, hdr->location);
+	heap_stat_add(s, hdr->num_longs * sizeof(long));
+	s->allocs++;
+
+	if (size)
+		bucket = BITS_PER_LONG - 1 - __builtin_clzl(size);
+	if (bucket >= HEAP_STATS_BUCKETS)
+		bucket = HEAP_STATS_BUCKETS - 1;
+	region->stats->histogram[bucket]++;
+}
+
+static void heap_stat_free(struct mem_region *region,
+			   const struct alloc_hdr *hdr)
+{
+	struct heap_stat *s;
+
+	if (!region->stats)
+		return;
+
+	s = heap_stat_find(region->stats, hdr->location);
+	s->cur_bytes -= hdr->num_longs * sizeof(long);
+	s->frees++;
+}
+
+/* A resize may also hand the block over to a new location */
+static void heap_stat_resize(struct mem_region *region,
+			     const char *old_location, size_t old_longs,
+			     const struct alloc_hdr *hdr)
+{
+	struct heap_stat *s;
+
+	if (!region->stats)
+		return;
+
+	s = heap_stat_find(region->stats, old_location);
+	s->cur_bytes -= old_longs * sizeof(long);
+	s = heap_stat_find(region->stats, hdr->location);
+	heap_stat_add(s, hdr->num_longs * sizeof(long));
+}
+
 static const char *hdr_location(const struct alloc_hdr *hdr)
 {
 	/* Corrupt: step carefully! */
@@ -255,7 +446,7 @@ static void mem_dump_allocs(void)
 		       (long long)region->start,
 		       (long long)(region->start + region->len - 1),
 		       region->name);
-		if (region->free_list.n.next == NULL) {
+		if (!region_initialized(region)) {
 			printf("    no allocs\n");
 			continue;
 		}
@@ -286,7 +477,7 @@ static void *__mem_alloc(struct mem_region *region, size_t size, size_t align,
 		return NULL;
 
 	/* First allocation? */
-	if (region->free_list.n.next == NULL)
+	if (!region_initialized(region))
 		init_allocatable_region(region);
 
 	/* Don't do screwy sizes. */
@@ -304,21 +495,15 @@ static void *__mem_alloc(struct mem_region *region, size_t size, size_t align,
 	if (alloc_longs < ALLOC_MIN_LONGS)
 		alloc_longs = ALLOC_MIN_LONGS;
 
-	/* Walk free list. */
-	list_for_each(&region->free_list, f, list) {
-		/* We may have to skip some to meet alignment. */
-		if (fits(f, alloc_longs, align, &offset))
-			goto found;
-	}
-
-	return NULL;
+	f = find_free(region, alloc_longs, align, &offset);
+	if (!f)
+		return NULL;
 
-found:
 	assert(f->hdr.free);
 	assert(!f->hdr.prev_free);
 
 	/* This block is no longer free. */
-	list_del_from(&region->free_list, &f->list);
+	free_list_del(region, f);
 	f->hdr.free = false;
 	f->hdr.location = location;
 
@@ -354,6 +539,8 @@ found:
 	/* Clear tailer for debugging */
 	*tailer(f) = 0;
 
+	heap_stat_alloc(region, &f->hdr, size);
+
 	/* Their pointer is immediately after header. */
 	return &f->hdr + 1;
 }
@@ -393,6 +580,7 @@ void mem_free(struct mem_region *region, void *mem, const char *location)
 	if (hdr->free)
 		bad_header(region, hdr, "re-freed", location);
 
+	heap_stat_free(region, hdr);
 	make_free(region, (struct free_hdr *)hdr, location);
 }
 
@@ -407,6 +595,8 @@ bool mem_resize(struct mem_region *region, void *mem, size_t len,
 {
 	struct alloc_hdr *hdr, *next;
 	struct free_hdr *f;
+	const char *old_location;
+	size_t old_longs;
 
 	/* This should be a constant. */
 	assert(is_rodata(location));
@@ -415,6 +605,8 @@ bool mem_resize(struct mem_region *region, void *mem, size_t len,
 	hdr = mem - sizeof(*hdr);
 	if (hdr->free)
 		bad_header(region, hdr, "resize", location);
+	old_location = hdr->location;
+	old_longs = hdr->num_longs;
 
 	/* Round up size to multiple of longs. */
 	len = (sizeof(*hdr) + len + sizeof(long) - 1) / sizeof(long);
@@ -427,6 +619,7 @@ bool mem_resize(struct mem_region *region, void *mem, size_t len,
 	if (len <= hdr->num_longs) {
 		hdr->location = location;
 		discard_excess(region, hdr, len, location);
+		heap_stat_resize(region, old_location, old_longs, hdr);
 		return true;
 	}
 
@@ -437,7 +630,7 @@ bool mem_resize(struct mem_region *region, void *mem, size_t len,
 
 	/* OK, it's free and big enough, absorb it. */
 	f = (struct free_hdr *)next;
-	list_del_from(&region->free_list, &f->list);
+	free_list_del(region, f);
 	hdr->num_longs += next->num_longs;
 	hdr->location = location;
 
@@ -453,6 +646,7 @@ bool mem_resize(struct mem_region *region, void *mem, size_t len,
 
 	/* Now we might have *too* much. */
 	discard_excess(region, hdr, len, location);
+	heap_stat_resize(region, old_location, old_longs, hdr);
 	return true;
 }
 
@@ -461,6 +655,7 @@ bool mem_check(const struct mem_region *region)
 	size_t frees = 0;
 	struct alloc_hdr *hdr, *prev_free = NULL;
 	struct free_hdr *f;
+	unsigned int bin;
 
 	/* Check it's sanely aligned. */
 	if (region->start % sizeof(struct alloc_hdr)) {
@@ -476,7 +671,7 @@ bool mem_check(const struct mem_region *region)
 
 	/* Not ours to play with, or empty?  Don't do anything. */
 	if (region->type != REGION_SKIBOOT_HEAP ||
-			region->free_list.n.next == NULL)
+			!region_initialized(region))
 		return true;
 
 	/* Walk linearly. */
@@ -521,9 +716,27 @@ bool mem_check(const struct mem_region *region)
 		}
 	}
 
-	/* Now walk free list. */
-	list_for_each(&region->free_list, f, list)
-		frees ^= (unsigned long)f - region->start;
+	/* Now walk free lists. */
+	for (bin = 0; bin < MEM_REGION_FREE_BINS; bin++) {
+		bool empty = list_empty(&region->free_list[bin]);
+
+		if (empty == !!(region->free_list_map & (1UL << bin))) {
+			prerror("Region '%s' free list %u %sempty but map %sset\n",
+				region->name, bin, empty ? "" : "not ",
+				empty ? "" : "un");
+			return false;
+		}
+		list_for_each(&region->free_list[bin], f, list) {
+			if (size_to_bin(f->hdr.num_longs) != bin) {
+				prerror("Region '%s' free %p (%s) size %zu"
+					" on wrong list %u\n",
+					region->name, f, hdr_location(&f->hdr),
+					f->hdr.num_longs * sizeof(long), bin);
+				return false;
+			}
+			frees ^= (unsigned long)f - region->start;
+		}
+	}
 
 	if (frees) {
 		prerror("Region '%s' free list and walk do not match!\n",
@@ -551,7 +764,14 @@ static struct mem_region *new_region(const char *name,
 	region->len = len;
 	region->mem_node = mem_node;
 	region->type = type;
-	region->free_list.n.next = NULL;
+	region->free_list[0].n.next = NULL;
+	/*
+	 * Anything allocated from a global region goes under
+	 * mem_region_lock, so it shares skiboot_heap's table. Chip
+	 * heaps are not made here: mem_region_init_chip_heaps() gives
+	 * each its own table inside the chip heap.
+	 */
+	region->stats = &skiboot_heap_stats;
 
 	return region;
 }
@@ -660,6 +880,19 @@ static bool matches_chip_id(const __be32 ids[], size_t num, u32 chip_id)
 	return false;
 }
 
+static bool region_on_chip(const struct mem_region *region, u32 chip_id)
+{
+	const struct dt_property *prop;
+
+	if (!region->mem_node)
+		return false;
+	prop = dt_find_property(region->mem_node, "ibm,chip-id");
+	if (!prop)
+		return false;
+	return matches_chip_id((const __be32 *)prop->prop,
+			       prop->len / sizeof(u32), chip_id);
+}
+
 void *__local_alloc(unsigned int chip_id, size_t size, size_t align,
 		    const char *location)
 {
@@ -671,9 +904,6 @@ void *__local_alloc(unsigned int chip_id, size_t size, size_t align,
 
 restart:
 	list_for_each(&regions, region, list) {
-		const struct dt_property *prop;
-		const __be32 *ids;
-
 		if (region->type != REGION_SKIBOOT_HEAP)
 			continue;
 
@@ -682,15 +912,8 @@ restart:
 			continue;
 
 		/* First pass, only match node local regions */
-		if (use_local) {
-			if (!region->mem_node)
-				continue;
-			prop = dt_find_property(region->mem_node, "ibm,chip-id");
-			ids = (const __be32 *)prop->prop;
-			if (!matches_chip_id(ids, prop->len/sizeof(u32),
-					     chip_id))
-				continue;
-		}
+		if (use_local && !region_on_chip(region, chip_id))
+			continue;
 
 		/* Second pass, match anything */
 		p = mem_alloc(region, size, align, location);
@@ -712,6 +935,228 @@ restart:
 	return p;
 }
 
+/* Carve a heap for each chip out of the first of its memory nodes
+ * which has room. Chips without local memory just use the others.
+ */
+static void mem_region_init_chip_heaps(void)
+{
+	struct mem_region *region;
+	struct chip_heap *heap;
+	void *p;
+	u32 chip_id;
+
+	lock(&mem_region_lock);
+	list_for_each(&regions, region, list) {
+		if (region->type != REGION_SKIBOOT_HEAP ||
+		    region == &skiboot_heap || !region->mem_node)
+			continue;
+
+		chip_id = dt_prop_get_u32_def(region->mem_node,
+					      "ibm,chip-id", 0xffffffff);
+		if (chip_id >= MAX_CHIPS || chip_heaps[chip_id])
+			continue;
+
+		p = __mem_alloc(region, CHIP_HEAP_SIZE, 0x10000, __location__);
+		if (!p)
+			continue;
+		heap = mem_alloc(&skiboot_heap, sizeof(*heap),
+				 __alignof__(*heap), __location__);
+		if (!heap) {
+			mem_free(region, p, __location__);
+			break;
+		}
+
+		heap->region.name = "ibm,firmware-chip-heap";
+		heap->region.start = (unsigned long)p;
+		heap->region.len = CHIP_HEAP_SIZE;
+		heap->region.mem_node = region->mem_node;
+		heap->region.type = REGION_SKIBOOT_HEAP;
+		heap->region.free_list[0].n.next = NULL;
+		heap->region.stats = NULL;
+		init_lock(&heap->lock);
+
+		/* Its accounting table lives in the chip heap itself */
+		heap->region.stats = __mem_alloc(&heap->region,
+						 sizeof(struct heap_stats),
+						 __alignof__(struct heap_stats),
+						 __location__);
+		if (heap->region.stats) {
+			heap_stats_init(heap->region.stats);
+			heap_stats_add_desc(heap->region.stats);
+		}
+		chip_heaps[chip_id] = heap;
+
+		printf("MEM: Chip %d heap at 0x%llx\n", chip_id,
+		       (long long)heap->region.start);
+	}
+	unlock(&mem_region_lock);
+}
+
+static bool in_region(const struct mem_region *region, const void *mem)
+{
+	return mem >= region_start(region) &&
+		mem < region_start(region) + region->len;
+}
+
+/* Which chip heap does this allocation belong to, if any? */
+static struct chip_heap *chip_heap_of(const void *mem)
+{
+	struct chip_heap *heap;
+	unsigned int i;
+
+	heap = chip_heaps[this_cpu()->chip_id];
+	if (heap && in_region(&heap->region, mem))
+		return heap;
+	if (in_region(&skiboot_heap, mem))
+		return NULL;
+	for (i = 0; i < MAX_CHIPS; i++) {
+		heap = chip_heaps[i];
+		if (heap && in_region(&heap->region, mem))
+			return heap;
+	}
+	return NULL;
+}
+
+static void *chip_heap_alloc(struct chip_heap *heap, size_t size,
+			     size_t align, const char *location)
+{
+	void *p;
+
+	lock(&heap->lock);
+	p = __mem_alloc(&heap->region, size, align, location);
+	unlock(&heap->lock);
+
+	return p;
+}
+
+void *mem_heap_alloc(size_t size, size_t align, const char *location)
+{
+	u32 chip_id = this_cpu()->chip_id;
+	unsigned int i;
+	void *p;
+
+	/* Local first... */
+	if (chip_heaps[chip_id]) {
+		p = chip_heap_alloc(chip_heaps[chip_id], size, align, location);
+		if (p)
+			return p;
+	}
+
+	/* ... then the other chips ... */
+	for (i = 0; i < MAX_CHIPS; i++) {
+		if (i == chip_id || !chip_heaps[i])
+			continue;
+		p = chip_heap_alloc(chip_heaps[i], size, align, location);
+		if (p)
+			return p;
+	}
+
+	/* ... and skiboot_heap as the last resort. */
+	lock(&mem_region_lock);
+	p = mem_alloc(&skiboot_heap, size, align, location);
+	unlock(&mem_region_lock);
+
+	return p;
+}
+
+void mem_heap_free(void *mem, const char *location)
+{
+	struct chip_heap *heap;
+
+	/* Freeing NULL is always a noop. */
+	if (!mem)
+		return;
+
+	heap = chip_heap_of(mem);
+	if (heap) {
+		lock(&heap->lock);
+		mem_free(&heap->region, mem, location);
+		unlock(&heap->lock);
+	} else {
+		lock(&mem_region_lock);
+		mem_free(&skiboot_heap, mem, location);
+		unlock(&mem_region_lock);
+	}
+}
+
+unsigned int mem_heap_alloc_batch(size_t size, size_t align, void **objs,
+				  unsigned int n, const char *location)
+{
+	struct chip_heap *heap = chip_heaps[this_cpu()->chip_id];
+	unsigned int i = 0;
+
+	if (heap) {
+		lock(&heap->lock);
+		for (; i < n; i++) {
+			objs[i] = __mem_alloc(&heap->region, size, align,
+					      location);
+			if (!objs[i])
+				break;
+		}
+		unlock(&heap->lock);
+	}
+	if (i == n)
+		return n;
+
+	lock(&mem_region_lock);
+	for (; i < n; i++) {
+		objs[i] = mem_alloc(&skiboot_heap, size, align, location);
+		if (!objs[i])
+			break;
+	}
+	unlock(&mem_region_lock);
+
+	return i;
+}
+
+void mem_heap_free_batch(void **objs, unsigned int n, const char *location)
+{
+	struct lock *held = NULL, *l;
+	struct chip_heap *heap;
+	unsigned int i;
+
+	/* Only switch locks when the next object is from another heap */
+	for (i = 0; i < n; i++) {
+		heap = chip_heap_of(objs[i]);
+		l = heap ? &heap->lock : &mem_region_lock;
+		if (l != held) {
+			if (held)
+				unlock(held);
+			lock(l);
+			held = l;
+		}
+		mem_free(heap ? &heap->region : &skiboot_heap, objs[i],
+			 location);
+	}
+	if (held)
+		unlock(held);
+}
+
+bool mem_heap_resize(void *mem, size_t len, const char *location)
+{
+	struct chip_heap *heap;
+	bool ok;
+
+	heap = chip_heap_of(mem);
+	if (heap) {
+		lock(&heap->lock);
+		ok = mem_resize(&heap->region, mem, len, location);
+		unlock(&heap->lock);
+	} else {
+		lock(&mem_region_lock);
+		ok = mem_resize(&skiboot_heap, mem, len, location);
+		unlock(&mem_region_lock);
+	}
+	return ok;
+}
+
+size_t mem_heap_size(const void *mem)
+{
+	struct chip_heap *heap = chip_heap_of(mem);
+
+	return mem_size(heap ? &heap->region : &skiboot_heap, mem);
+}
+
 struct mem_region *find_mem_region(const char *name)
 {
 	struct mem_region *region;
@@ -723,6 +1168,19 @@ struct mem_region *find_mem_region(const char *name)
 	return NULL;
 }
 
+/* Walk all the regions, starting with NULL. No locking, only use once
+ * the region list is settled.
+ */
+struct mem_region *mem_region_next(struct mem_region *region)
+{
+	struct list_node *node;
+
+	node = region ? region->list.next : regions.n.next;
+	if (node == &regions.n)
+		return NULL;
+	return list_entry(node, struct mem_region, list);
+}
+
 /* Trawl through device tree, create memory regions from nodes. */
 void mem_region_init(void)
 {
@@ -734,6 +1192,8 @@ void mem_region_init(void)
 	extern char _end[];
 	BUILD_ASSERT(HEAP_BASE >= (uint64_t)_end);
 
+	heap_stats_add_desc(&skiboot_heap_stats);
+
 	/*
 	 * Add associativity properties outside of the lock
 	 * to avoid recursive locking caused by allocations
@@ -824,20 +1284,24 @@ void mem_region_init(void)
 		dt_del_property(dt_root, (struct dt_property *)names);
 	if (ranges)
 		dt_del_property(dt_root, (struct dt_property *)ranges);
+
+	mem_region_init_chip_heaps();
 }
 
 static uint64_t allocated_length(const struct mem_region *r)
 {
 	struct free_hdr *f, *last = NULL;
+	unsigned int bin;
 
 	/* No allocations at all? */
-	if (r->free_list.n.next == NULL)
+	if (!region_initialized(r))
 		return 0;
 
 	/* Find last free block. */
-	list_for_each(&r->free_list, f, list)
-		if (f > last)
-			last = f;
+	for (bin = 0; bin < MEM_REGION_FREE_BINS; bin++)
+		list_for_each(&r->free_list[bin], f, list)
+			if (f > last)
+				last = f;
 
 	/* No free blocks? */
 	if (!last)
@@ -882,7 +1346,7 @@ void mem_region_release_unused(void)
 			struct free_hdr *last = region_start(r) + used_len;
 
 			/* Remove the final free block. */
-			list_del_from(&r->free_list, &last->list);
+			free_list_del(r, last);
 
 			for_linux = split_region(r, r->start + used_len,
 						 REGION_OS);
@@ -28,6 +28,7 @@
 #include <timebase.h>
 #include <affinity.h>
 #include <opal-msg.h>
+#include <boot-timeline.h>
 
 /* Pending events to signal via opal_poll_events */
 uint64_t opal_pending_events;
@@ -41,6 +42,12 @@ static u8 opal_num_args[OPAL_LAST+1];
 /* OPAL anchor node */
 struct dt_node *opal_node;
 
+/*
+ * Held while running the pollers, which don't expect to run on
+ * several CPUs at once. Named in opal_table_init().
+ */
+static struct lock opal_poll_lock = LOCK_UNLOCKED;
+
 extern uint32_t attn_trigger;
 extern uint32_t hir_trigger;
 
@@ -51,6 +58,7 @@ void opal_table_init(void)
 
 	printf("OPAL table: %p .. %p, branch table: %p\n",
 	       s, e, opal_branch_table);
+	lock_set_name(&opal_poll_lock, "opal_poll");
 	while(s < e) {
 		uint64_t *func = s->func;
 		opal_branch_table[s->token] = *func;
@@ -147,6 +155,7 @@ void add_opal_node(void)
 	add_opal_firmware_node();
 	add_associativity_ref_point();
 	memcons_add_properties();
+	boot_timeline_add_properties();
 	add_cpu_idle_state_properties();
 }
 
@@ -182,7 +191,7 @@ struct opal_poll_entry {
 };
 
 static struct list_head opal_pollers = LIST_HEAD_INIT(opal_pollers);
-static struct lock opal_poll_lock = LOCK_UNLOCKED;
+static struct rwlock opal_pollers_lock = RWLOCK_UNLOCKED;
 
 void opal_add_poller(void (*poller)(void *data), void *data)
 {
@@ -192,16 +201,16 @@ void opal_add_poller(void (*poller)(void *data), void *data)
 	assert(ent);
 	ent->poller = poller;
 	ent->data = data;
-	lock(&opal_poll_lock);
+	write_lock(&opal_pollers_lock);
 	list_add_tail(&opal_pollers, &ent->link);
-	unlock(&opal_poll_lock);
+	write_unlock(&opal_pollers_lock);
 }
 
 void opal_del_poller(void (*poller)(void *data))
 {
 	struct opal_poll_entry *ent;
 
-	lock(&opal_poll_lock);
+	write_lock(&opal_pollers_lock);
 	list_for_each(&opal_pollers, ent, link) {
 		if (ent->poller == poller) {
 			list_del(&ent->link);
@@ -209,7 +218,7 @@ void opal_del_poller(void (*poller)(void *data))
 			break;
 		}
 	}
-	unlock(&opal_poll_lock);
+	write_unlock(&opal_pollers_lock);
 }
 
 static int64_t opal_poll_events(uint64_t *outstanding_event_mask)
@@ -233,8 +242,10 @@ static int64_t opal_poll_events(uint64_t *outstanding_event_mask)
 	 * on another CPU
 	 */
 	if (try_lock(&opal_poll_lock)) {
+		read_lock(&opal_pollers_lock);
 		list_for_each(&opal_pollers, poll_ent, link)
 			poll_ent->poller(poll_ent->data);
+		read_unlock(&opal_pollers_lock);
 		unlock(&opal_poll_lock);
 	}
 
@@ -20,8 +20,9 @@
 #include <timebase.h>
 #include <lock.h>
 #include <device.h>
+#include <boot-timeline.h>
 
-static struct lock pci_lock = LOCK_UNLOCKED;
+struct lock pci_lock = LOCK_UNLOCKED;
 #define PCI_MAX_PHBs	64
 static struct phb *phbs[PCI_MAX_PHBs];
 
@@ -587,59 +588,81 @@ int32_t pci_configure_mps(struct phb *phb, struct pci_device *pd)
 	return __pci_configure_mps(phb, pd, NULL);
 }
 
+/*
+ * Where a PHB is at in its slot reset, pci_init_slots() runs all of
+ * them side by side.
+ */
+struct pci_slot_reset {
+	bool		empty;		/* Nothing to scan */
+	int64_t		rc;		/* > 0: poll the PHB again at next */
+	unsigned long	next;
+	const char	*desc;
+	int		ev;
+};
+
 /*
  * The power state would be checked. If the power has
  * been on, we will issue fundamental reset. Otherwise,
  * we will power it on before issuing fundamental reset.
  */
-static int64_t pci_reset_phb(struct phb *phb)
+static void pci_start_reset_phb(struct phb *phb, struct pci_slot_reset *r)
 {
-	const char *desc;
 	int64_t rc;
 
 	rc = phb->ops->power_state(phb);
 	if (rc < 0) {
 		printf("PHB%d: Failed to get power state, rc=%lld\n",
 			phb->opal_id, rc);
-		return rc;
+		r->rc = rc;
+		return;
 	}
 
 	if (rc == OPAL_SHPC_POWER_ON) {
-		desc = "fundamental reset";
+		r->desc = "fundamental reset";
 		rc = phb->ops->fundamental_reset(phb);
 	} else {
-		desc = "power on";
+		r->desc = "power on";
 		rc = phb->ops->slot_power_on(phb);
 	}
 
-	if (rc < 0) {
-		/* Don't warn if it's just an empty slot */
-		if (rc != OPAL_CLOSED)
-			printf("PHB%d: Failed to %s, rc=%lld\n",
-			       phb->opal_id, desc, rc);
-		return rc;
-	}
+	/* Don't warn if it's just an empty slot */
+	if (rc < 0 && rc != OPAL_CLOSED)
+		printf("PHB%d: Failed to %s, rc=%lld\n",
+		       phb->opal_id, r->desc, rc);
+	r->rc = rc;
+	if (rc > 0)
+		r->next = mftb() + rc;
+}
 
-	/* Wait the internal state machine */
-	while (rc > 0) {
-		time_wait(rc);
-		rc = phb->ops->poll(phb);
+/* Step the internal state machine when due, returns true once done */
+static bool pci_poll_reset_phb(struct phb *phb, struct pci_slot_reset *r)
+{
+	if (r->rc > 0) {
+		if (tb_compare(mftb(), r->next) == TB_ABEFOREB)
+			return false;
+		r->rc = phb->ops->poll(phb);
+		if (r->rc > 0) {
+			r->next = mftb() + r->rc;
+			return false;
+		}
+		if (r->rc < 0)
+			printf("PHB%d: Failed to %s, rc=%lld\n",
+			       phb->opal_id, r->desc, r->rc);
 	}
-	if (rc < 0)
-		printf("PHB%d: Failed to %s, rc=%lld\n",
-			phb->opal_id, desc, rc);
 
-        return rc;
+	boot_timeline_end(r->ev);
+	r->ev = -1;
+	return true;
 }
 
-static void pci_init_slot(struct phb *phb)
+static void pci_start_slot(struct phb *phb, struct pci_slot_reset *r)
 {
-	uint32_t mps = 0xffffffff;
 	int64_t rc;
-	bool has_link;
 
 	printf("PHB%d: Init slot\n", phb->opal_id);
 
+	r->ev = -1;
+
 	/*
 	 * For PCI/PCI-X, we get the slot info and we also
 	 * check if the PHB has anything connected to it
@@ -650,6 +673,7 @@ static void pci_init_slot(struct phb *phb)
 		rc = phb->ops->presence_detect(phb);
 		if (rc != OPAL_SHPC_DEV_PRESENT) {
 			printf("PHB%d: Slot empty\n", phb->opal_id);
+			r->empty = true;
 			return;
 		}
 	}
@@ -659,8 +683,17 @@ static void pci_init_slot(struct phb *phb)
 	 * fundamental way while powering on. The reset
 	 * state machine is going to wait for the link
 	 */
-	rc = pci_reset_phb(phb);
-	if (rc && rc != OPAL_CLOSED)
+	r->ev = boot_timeline_start("phb-reset", phb->opal_id);
+	pci_start_reset_phb(phb, r);
+}
+
+static void pci_scan_slot(struct phb *phb, struct pci_slot_reset *r)
+{
+	uint32_t mps = 0xffffffff;
+	int64_t rc;
+	bool has_link;
+
+	if (r->empty || (r->rc && r->rc != OPAL_CLOSED))
 		return;
 
 	/* It's up, print some things */
@@ -1308,19 +1341,53 @@ void pci_reset(void)
 
 void pci_init_slots(void)
 {
+	/* Too big for the stack, we hold pci_lock while using it */
+	static struct pci_slot_reset resets[PCI_MAX_PHBs];
+	unsigned long next = 0, now;
 	unsigned int i;
+	bool pending;
+	int ev;
 
 	printf("PCI: Probing PHB slots...\n");
 
 	lock(&pci_lock);
 
-	/* XXX Do those in parallel (at least the power up
-	 * state machine could be done in parallel)
+	/*
+	 * Link training takes hundreds of ms per PHB, so start every
+	 * slot reset first and step all the state machines as they
+	 * come due, rather than one PHB after the other.
 	 */
+	memset(resets, 0, sizeof(resets));
+	for (i = 0; i < PCI_MAX_PHBs; i++) {
+		if (!phbs[i])
+			continue;
+		pci_start_slot(phbs[i], &resets[i]);
+	}
+
+	for (;;) {
+		pending = false;
+		for (i = 0; i < PCI_MAX_PHBs; i++) {
+			if (!phbs[i] || pci_poll_reset_phb(phbs[i], &resets[i]))
+				continue;
+			if (!pending ||
+			    tb_compare(resets[i].next, next) == TB_ABEFOREB)
+				next = resets[i].next;
+			pending = true;
+		}
+		if (!pending)
+			break;
+		now = mftb();
+		if (tb_compare(next, now) == TB_AAFTERB)
+			time_wait(next - now);
+	}
+
+	/* Scan in PHB order, which keeps the device-tree the same */
 	for (i = 0; i < PCI_MAX_PHBs; i++) {
 		if (!phbs[i])
 			continue;
-		pci_init_slot(phbs[i]);
+		ev = boot_timeline_start("phb-scan", phbs[i]->opal_id);
+		pci_scan_slot(phbs[i], &resets[i]);
+		boot_timeline_end(ev);
 	}
 
 	if (platform.pci_probe_complete)
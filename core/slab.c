@@ -0,0 +1,117 @@
+/* Copyright 2013-2014 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/* Per-CPU object caches on top of the skiboot heap */
+#include <skiboot.h>
+#include <mem_region.h>
+#include <lock.h>
+#include <cpu.h>
+#include <slab.h>
+
+struct slab_magazine {
+	unsigned int	count;
+	void		*objs[SLAB_MAG_SIZE];
+};
+
+/* How many objects we move to/from the heap at once */
+#define SLAB_BATCH	(SLAB_MAG_SIZE / 2)
+
+static struct lock slab_lock = LOCK_UNLOCKED;
+static int slab_next_index;
+
+static struct slab_magazine *slab_get_magazine(struct slab_cache *cache)
+{
+	struct cpu_thread *cpu = this_cpu();
+
+	if (cache->index < 0) {
+		lock(&slab_lock);
+		if (cache->index < 0) {
+			assert(slab_next_index < SLAB_MAX_CACHES);
+			cache->index = slab_next_index++;
+		}
+		unlock(&slab_lock);
+	}
+
+	if (!cpu->slab_mags[cache->index])
+		cpu->slab_mags[cache->index] = zalloc(sizeof(struct slab_magazine));
+	return cpu->slab_mags[cache->index];
+}
+
+void *slab_alloc(struct slab_cache *cache)
+{
+	struct slab_magazine *mag = slab_get_magazine(cache);
+
+	/* No magazine, fall back to the heap */
+	if (!mag)
+		return __malloc(cache->size, cache->location);
+
+	if (!mag->count) {
+		mag->count = mem_heap_alloc_batch(cache->size,
+						  __alignof__(long), mag->objs,
+						  SLAB_BATCH, cache->location);
+		if (!mag->count) {
+			prerror("SLAB: Failed to refill %s cache\n", cache->name);
+			return NULL;
+		}
+	}
+
+	return mag->objs[--mag->count];
+}
+
+void *slab_zalloc(struct slab_cache *cache)
+{
+	void *obj = slab_alloc(cache);
+
+	if (obj)
+		memset(obj, 0, cache->size);
+	return obj;
+}
+
+void slab_free(struct slab_cache *cache, void *obj)
+{
+	struct slab_magazine *mag;
+
+	if (!obj)
+		return;
+
+	mag = slab_get_magazine(cache);
+	if (!mag) {
+		__free(obj, cache->location);
+		return;
+	}
+
+	if (mag->count == SLAB_MAG_SIZE) {
+		mag->count -= SLAB_BATCH;
+		mem_heap_free_batch(&mag->objs[mag->count], SLAB_BATCH,
+				    cache->location);
+	}
+
+	mag->objs[mag->count++] = obj;
+}
+
+void slab_drain(void)
+{
+	struct cpu_thread *cpu = this_cpu();
+	struct slab_magazine *mag;
+	unsigned int i;
+
+	for (i = 0; i < SLAB_MAX_CACHES; i++) {
+		mag = cpu->slab_mags[i];
+		if (!mag || !mag->count)
+			continue;
+		mem_heap_free_batch(mag->objs, mag->count, __location__);
+		mag->count = 0;
+	}
+}
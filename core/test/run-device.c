@@ -33,6 +33,101 @@ static inline bool fake_is_rodata(const void *p)
 #include "../../ccan/list/list.c" /* For list_check */
 #include <assert.h>
 
+/* What dt_find_compatible_node() used to do, without the index */
+static struct dt_node *slow_find_compatible(struct dt_node *root,
+					    struct dt_node *prev,
+					    const char *compat)
+{
+	struct dt_node *node;
+
+	node = prev ? dt_next(root, prev) : root;
+	for (; node; node = dt_next(root, node))
+		if (dt_node_is_compatible(node, compat))
+			return node;
+	return NULL;
+}
+
+static void check_compatible(struct dt_node *root, const char *compat)
+{
+	struct dt_node *node = NULL, *slow = NULL;
+
+	do {
+		node = dt_find_compatible_node(root, node, compat);
+		slow = slow_find_compatible(root, slow, compat);
+		assert(node == slow);
+	} while (node);
+}
+
+static void test_search_index(void)
+{
+	struct dt_node *root, *sub, *n, *nodes[64];
+	u32 phandle;
+	unsigned int i;
+
+	root = dt_new_root("");
+	for (i = 0; i < 64; i++) {
+		/* Scatter them around so creation and tree order differ */
+		n = i < 8 ? root : nodes[rand() % i];
+		nodes[i] = dt_new_addr(n, "n", i);
+		if (i % 3 == 0)
+			dt_add_property_strings(nodes[i], "compatible",
+						"test,a", "test,b");
+		else if (i % 3 == 1)
+			dt_add_property_string(nodes[i], "compatible",
+					       "TEST,B");
+		dt_add_property_cells(nodes[i], "ibm,chip-id", i % 2);
+	}
+	check_compatible(root, "test,a");
+	check_compatible(root, "test,b");
+	for (i = 0; i < 64; i++) {
+		/* dt_next() doesn't stay inside a childless root */
+		if (list_empty(&nodes[i]->children))
+			continue;
+		check_compatible(nodes[i], "test,a");
+		check_compatible(nodes[i], "test,b");
+	}
+	assert(!dt_find_compatible_node(root, NULL, "test,c"));
+
+	n = NULL;
+	i = 0;
+	while ((n = dt_find_compatible_node_on_chip(root, n, "test,b", 1))) {
+		assert(dt_get_chip_id(n) == 1);
+		i++;
+	}
+	assert(i == 22);
+
+	/* Grafting a subtree built on the side */
+	sub = dt_new_root("sub");
+	dt_add_property_string(sub, "compatible", "test,a");
+	n = dt_new(sub, "child");
+	dt_add_property_string(n, "compatible", "test,a");
+	check_compatible(root, "test,a");
+	assert(dt_attach_root(nodes[0], sub));
+	check_compatible(root, "test,a");
+	check_compatible(sub, "test,a");
+
+	/* Deleting and freeing */
+	dt_del_property(nodes[6], __dt_find_property(nodes[6], "compatible"));
+	check_compatible(root, "test,a");
+	dt_free(nodes[1]);
+	check_compatible(root, "test,b");
+
+	/* Phandles, including ones set from a property */
+	assert(dt_find_by_phandle(root, nodes[4]->phandle) == nodes[4]);
+	assert(!dt_find_by_phandle(nodes[3], nodes[4]->phandle));
+	assert(!dt_find_by_phandle(root, root->phandle));
+	phandle = last_phandle + 100;
+	dt_add_property(nodes[5], "phandle", &phandle, sizeof(phandle));
+	assert(dt_find_by_phandle(root, phandle) == nodes[5]);
+	assert(dt_find_by_phandle(root, nodes[6]->phandle) == nodes[6]);
+
+	/* Everything is gone from the indexes with the tree. */
+	dt_free(root);
+	assert(!dt_phandles[phandle % DT_PHANDLE_BUCKETS]);
+	assert(!dt_compat_get("test,a", false)->count);
+	assert(!dt_compat_get("test,b", false)->count);
+}
+
 int main(void)
 {
 	struct dt_node *root, *c1, *c2, *gc1, *gc2, *gc3, *ggc1, *i;
@@ -112,7 +207,80 @@ int main(void)
 	dt_del_property(c1, p2);
 	list_check(&c1->properties, "properties after delete");
 
+	/* Property names are interned. */
+	assert(dt_find_property(c2, "visited")->name
+	       == dt_find_property(gc2, "visited")->name);
+	assert(dt_find_name("visited") == dt_find_property(c2, "visited")->name);
+	assert(!dt_find_name("never-used"));
+	assert(!dt_find_property(c2, "never-used"));
+
+	/* Lots of properties get a hash index. */
+	for (n = 0; n < DT_PROP_INDEX_MIN * 4; n++) {
+		char name[16];
+
+		snprintf(name, sizeof(name), "prop-%u", n);
+		dt_add_property_cells(c2, name, n);
+		assert(!c2->prop_index == (c2->num_props <= DT_PROP_INDEX_MIN));
+	}
+	assert(c2->num_props == DT_PROP_INDEX_MIN * 4 + 1);
+	for (n = 0; n < DT_PROP_INDEX_MIN * 4; n++) {
+		char name[16];
+
+		snprintf(name, sizeof(name), "prop-%u", n);
+		assert(dt_prop_get_u32(c2, name) == n);
+	}
+	assert(!dt_find_property(c2, "some-property"));
+
+	/* The index follows deletes and resizes. */
+	dt_del_property(c2, __dt_find_property(c2, "prop-3"));
+	assert(!dt_find_property(c2, "prop-3"));
+	assert(dt_prop_get_u32(c2, "prop-4") == 4);
+	p = p2 = __dt_find_property(c2, "prop-5");
+	n = p2->len;
+	while (p2 == p) {
+		n *= 2;
+		dt_resize_property(&p2, n);
+	}
+	assert(dt_find_property(c2, "prop-5") == p2);
+	assert(dt_prop_get_cell(c2, "prop-5", 0) == 5);
+
 	/* No leaks for valgrind! */
 	dt_free(root);
+
+	test_search_index();
+
+	/* Bulk build from the arena. */
+	dt_arena_begin();
+	root = dt_new_root("root");
+	for (n = 0; n < 1000; n++) {
+		c1 = dt_new_addr(root, "c", n);
+		dt_add_property_cells(c1, "reg", n);
+		dt_add_property_string(c1, "compatible", "some,thing");
+	}
+	assert(dt_arena_owns(c1));
+	assert(dt_arena_owns(c1->name));
+	assert(dt_arena_owns(dt_find_property(c1, "reg")));
+	assert(list_top(&dt_arena.chunks, struct dt_arena_chunk, list)
+	       != list_tail(&dt_arena.chunks, struct dt_arena_chunk, list));
+	dt_arena_end();
+
+	/* Only new objects come from the heap now. */
+	c2 = dt_new(root, "c2");
+	assert(!dt_arena_owns(c2));
+
+	/* Resizing moves a property out of the arena. */
+	p2 = __dt_find_property(c1, "reg");
+	dt_resize_property(&p2, 64);
+	assert(!dt_arena_owns(p2));
+	assert(dt_property_get_cell(p2, 0) == n - 1);
+
+	/* Freeing part of the tree keeps the chunks... */
+	dt_free(c1);
+	assert(!list_empty(&dt_arena.chunks));
+
+	/* ... until everything is gone. */
+	dt_free(root);
+	assert(!dt_arena.live);
+	assert(list_empty(&dt_arena.chunks));
 	return 0;
 }
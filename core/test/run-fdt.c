@@ -0,0 +1,165 @@
+/* Copyright 2013-2014 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <config.h>
+
+/* Don't include this, it's PPC-specific */
+#define __CPU_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <skiboot.h>
+
+#define zalloc(bytes) calloc((bytes), 1)
+
+#include "../device.c"
+#include "../fdt.c"
+#include "../../libfdt/fdt.c"
+#include "../../libfdt/fdt_ro.c"
+
+#include <assert.h>
+
+char __rodata_start[1], __rodata_end[1];
+
+static const struct dt_property *next_prop(const struct dt_node *n,
+					   const struct dt_property *p)
+{
+	if (p->list.next == &n->properties.n)
+		return NULL;
+	return list_entry(p->list.next, struct dt_property, list);
+}
+
+static const struct dt_node *next_child(const struct dt_node *n,
+					const struct dt_node *c)
+{
+	if (c->list.next == &n->children.n)
+		return NULL;
+	return list_entry(c->list.next, struct dt_node, list);
+}
+
+/* Check the expanded copy has the same nodes and properties. */
+static void compare_nodes(const struct dt_node *a, const struct dt_node *b)
+{
+	const struct dt_property *pa, *pb;
+	const struct dt_node *ca, *cb;
+
+	assert(!strcmp(a->name, b->name));
+	/* dt_add_property() keeps phandles in blob (big endian) order */
+	assert(a->phandle == fdt32_to_cpu(b->phandle));
+
+	pb = list_top(&b->properties, struct dt_property, list);
+	list_for_each(&a->properties, pa, list) {
+		if (strstarts(pa->name, DT_PRIVATE))
+			continue;
+		assert(pb);
+		assert(pa->name == pb->name);
+		assert(pa->len == pb->len);
+		assert(!memcmp(pa->prop, pb->prop, pa->len));
+		pb = next_prop(b, pb);
+	}
+	assert(!pb);
+
+	cb = list_top(&b->children, struct dt_node, list);
+	list_for_each(&a->children, ca, list) {
+		assert(cb);
+		compare_nodes(ca, cb);
+		cb = next_child(b, cb);
+	}
+	assert(!cb);
+}
+
+int main(void)
+{
+	struct dt_node *root, *n, *copy;
+	struct dt_property *p;
+	const char *blob;
+	uint64_t ranges[4];
+	uint64_t addr, size;
+	unsigned int i;
+	size_t strings;
+	char name[32];
+
+	root = dt_new_root("");
+	dt_add_property_cells(root, "#address-cells", 2);
+	dt_add_property_cells(root, "#size-cells", 2);
+	ranges[0] = cpu_to_fdt64(0x1000000);
+	ranges[1] = cpu_to_fdt64(0x10000);
+	ranges[2] = cpu_to_fdt64(0x30000000);
+	ranges[3] = cpu_to_fdt64(0x400000);
+	dt_add_property(root, "reserved-ranges", ranges, sizeof(ranges));
+
+	for (i = 0; i < 100; i++) {
+		n = dt_new_addr(root, "node", i);
+		dt_add_property_string(n, "compatible", "test,node");
+		dt_add_property_cells(n, "reg", 0, i);
+		/* Odd lengths, to check the padding */
+		snprintf(name, sizeof(name), "name-%u", i);
+		dt_add_property_string(n, "label", name);
+		dt_add_property_cells(n, DT_PRIVATE "hidden", i);
+		if (i % 10 == 0)
+			dt_add_property(dt_new(n, "child"), "empty", NULL, 0);
+	}
+
+	fdt = create_dtb(root);
+	assert(fdt);
+	assert(fdt_check_header(fdt) == 0);
+
+	/* Reserve map copied over. */
+	assert(fdt_num_mem_rsv(fdt) == 2);
+	assert(fdt_get_mem_rsv(fdt, 1, &addr, &size) == 0);
+	/* The property is big endian, so this only swaps on LE hosts */
+	assert(addr == ranges[2] && size == ranges[3]);
+
+	/* Every name is there exactly once, and nothing else. */
+	blob = fdt + fdt_off_dt_strings(fdt);
+	strings = 0;
+	for (i = 0; i < fdt_size_dt_strings(fdt); i += strlen(blob + i) + 1)
+		strings++;
+	assert(strings == 9);
+	assert(fdt_totalsize(fdt) == fdt_off_dt_strings(fdt)
+	       + fdt_size_dt_strings(fdt));
+
+	/* And we get the same tree back. */
+	copy = dt_new_root("");
+	assert(dt_expand_node(copy, fdt, 0) > 0);
+	compare_nodes(root, copy);
+
+	dt_free(copy);
+
+	/* Expanding in place leaves the values in the blob... */
+	copy = dt_new_root("");
+	assert(dt_expand_node_ref(copy, fdt, 0) > 0);
+	compare_nodes(root, copy);
+	p = (struct dt_property *)
+		dt_find_property(dt_find_by_path(copy, "/node@5"), "label");
+	assert(p->prop > (char *)fdt
+	       && p->prop < (char *)fdt + fdt_totalsize(fdt));
+
+	/* ... until they are resized. */
+	dt_resize_property(&p, 32);
+	assert(p->prop == p->data);
+	assert(!strcmp(p->prop, "name-5"));
+	assert(dt_find_property(dt_find_by_path(copy, "/node@5"), "label") == p);
+	strcpy(p->prop, "a much longer label");
+	p->len = strlen(p->prop) + 1;
+	assert(!strcmp(fdt_getprop(fdt, fdt_path_offset(fdt, "/node@5"),
+				   "label", NULL), "name-5"));
+
+	dt_free(copy);
+	dt_free(root);
+	free(fdt);
+	return 0;
+}
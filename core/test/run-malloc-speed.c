@@ -23,6 +23,11 @@ static unsigned int cpu_max_pir = 1;
 struct cpu_thread {
 	unsigned int			chip_id;
 };
+static struct cpu_thread fake_cpu;
+static inline struct cpu_thread *this_cpu(void)
+{
+	return &fake_cpu;
+}
 
 #include <stdlib.h>
 
@@ -51,9 +56,11 @@ static inline void real_free(void *p)
 
 #include <assert.h>
 #include <stdio.h>
+#include <time.h>
 
 char __rodata_start[1], __rodata_end[1];
 struct dt_node *dt_root;
+struct debug_descriptor debug_descriptor;
 
 void lock(struct lock *l)
 {
@@ -72,6 +79,62 @@ void unlock(struct lock *l)
 
 #define NUM_ALLOCS 4096
 
+/* Size of the small holes in the fragmented heap test. */
+#define HOLE_SIZE 256
+
+static unsigned long elapsed_us(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) * 1000000
+		+ (end.tv_nsec - start->tv_nsec) / 1000;
+}
+
+/* Too big for the stack */
+static void *small[NUM_ALLOCS], *keep[NUM_ALLOCS * 2], *big[NUM_ALLOCS];
+
+/*
+ * Leave NUM_ALLOCS small holes in front of NUM_ALLOCS bigger ones
+ * on the free lists, then allocate exactly the bigger size. A single
+ * first-fit free list has to step over every small hole on each
+ * allocation, the binned lists go straight to the right size class.
+ */
+static void fragmented_heap(void)
+{
+	struct timespec start;
+	uint64_t i;
+
+	for (i = 0; i < NUM_ALLOCS; i++) {
+		small[i] = __malloc(HOLE_SIZE, __location__);
+		keep[i * 2] = __malloc(HOLE_SIZE, __location__);
+		big[i] = __malloc(HOLE_SIZE * 2, __location__);
+		keep[i * 2 + 1] = __malloc(HOLE_SIZE, __location__);
+		assert(small[i] && keep[i * 2] && big[i] && keep[i * 2 + 1]);
+	}
+	for (i = 0; i < NUM_ALLOCS; i++)
+		__free(big[i], __location__);
+	for (i = 0; i < NUM_ALLOCS; i++)
+		__free(small[i], __location__);
+	assert(mem_check(&skiboot_heap));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < NUM_ALLOCS; i++) {
+		big[i] = __malloc(HOLE_SIZE * 2, __location__);
+		assert(big[i]);
+	}
+	printf("%u allocs past %u holes: %luus\n",
+	       NUM_ALLOCS, NUM_ALLOCS, elapsed_us(&start));
+	assert(mem_check(&skiboot_heap));
+
+	for (i = 0; i < NUM_ALLOCS; i++) {
+		__free(big[i], __location__);
+		__free(keep[i * 2], __location__);
+		__free(keep[i * 2 + 1], __location__);
+	}
+	assert(mem_check(&skiboot_heap));
+}
+
 int main(void)
 {
 	uint64_t i, len;
@@ -89,6 +152,13 @@ int main(void)
 	}
 	assert(mem_check(&skiboot_heap));
 	assert(mem_region_lock.lock_val == 0);
+
+	for (i = 0; i < NUM_ALLOCS; i++)
+		__free(p[i], __location__);
+	assert(mem_check(&skiboot_heap));
+
+	fragmented_heap();
+	assert(mem_region_lock.lock_val == 0);
 	free(region_start(&skiboot_heap));
 	return 0;
 }
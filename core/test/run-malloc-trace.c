@@ -0,0 +1,342 @@
+/* Copyright 2013-2014 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replay allocation traces against the skiboot heap.
+ *
+ * Usage: run-malloc-trace [-r repeat] trace...
+ *
+ * Each trace line is one operation on a numbered slot:
+ *
+ *	a <slot> <size>			malloc
+ *	m <slot> <align> <size>		memalign
+ *	r <slot> <size>			realloc
+ *	f <slot>			free
+ *
+ * Blank lines and lines starting with '#' are ignored. Anything still
+ * allocated at the end of the trace is freed, and the heap must then be
+ * empty again, so this doubles as a regression test.
+ */
+
+#include <config.h>
+
+#define BITS_PER_LONG (sizeof(long) * 8)
+/* Don't include this, it's PPC-specific */
+#define __CPU_H
+static unsigned int cpu_max_pir = 1;
+struct cpu_thread {
+	unsigned int			chip_id;
+};
+static struct cpu_thread fake_cpu;
+static inline struct cpu_thread *this_cpu(void)
+{
+	return &fake_cpu;
+}
+
+#include <stdlib.h>
+
+/* Use these before we undefine them below. */
+static inline void *real_malloc(size_t size)
+{
+	return malloc(size);
+}
+
+static inline void real_free(void *p)
+{
+	return free(p);
+}
+
+#include <skiboot.h>
+
+/* We need mem_region to accept __location__ */
+#define is_rodata(p) true
+#include "../malloc.c"
+#include "../mem_region.c"
+#include "../device.c"
+
+#undef malloc
+#undef free
+#undef realloc
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+char __rodata_start[1], __rodata_end[1];
+struct dt_node *dt_root;
+struct debug_descriptor debug_descriptor;
+
+void lock(struct lock *l)
+{
+	assert(!l->lock_val);
+	l->lock_val = 1;
+}
+
+void unlock(struct lock *l)
+{
+	assert(l->lock_val);
+	l->lock_val = 0;
+}
+
+#define MAX_SLOTS	65536
+
+struct trace_op {
+	char		op;
+	unsigned int	slot;
+	size_t		align;
+	size_t		size;
+};
+
+struct trace_stats {
+	unsigned long	ops;
+	uint64_t	total_ns;
+	uint64_t	worst_ns;
+	size_t		live, peak_live;
+	unsigned long	high_water;
+	size_t		free_total, free_largest;
+};
+
+static void *slots[MAX_SLOTS];
+
+static uint64_t now_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+static struct trace_op *load_trace(const char *name, unsigned long *num)
+{
+	struct trace_op *ops = NULL, *op;
+	unsigned long n = 0, max = 0, line = 0;
+	char buf[128];
+	FILE *f;
+	int ok;
+
+	f = fopen(name, "r");
+	if (!f) {
+		perror(name);
+		exit(1);
+	}
+
+	while (fgets(buf, sizeof(buf), f)) {
+		line++;
+		if (buf[0] == '#' || buf[0] == '\n')
+			continue;
+		if (n == max) {
+			max = max ? max * 2 : 1024;
+			ops = realloc(ops, max * sizeof(*ops));
+			assert(ops);
+		}
+		op = &ops[n];
+		memset(op, 0, sizeof(*op));
+		op->op = buf[0];
+		switch (op->op) {
+		case 'a':
+		case 'r':
+			ok = sscanf(buf + 1, "%u %zu", &op->slot,
+				    &op->size) == 2;
+			break;
+		case 'm':
+			ok = sscanf(buf + 1, "%u %zu %zu", &op->slot,
+				    &op->align, &op->size) == 3;
+			break;
+		case 'f':
+			ok = sscanf(buf + 1, "%u", &op->slot) == 1;
+			break;
+		default:
+			ok = false;
+		}
+		if (!ok || op->slot >= MAX_SLOTS) {
+			fprintf(stderr, "%s:%lu: bad line '%s'\n",
+				name, line, buf);
+			exit(1);
+		}
+		n++;
+	}
+	fclose(f);
+
+	*num = n;
+	return ops;
+}
+
+static void free_space(struct trace_stats *s)
+{
+	struct free_hdr *f;
+	unsigned int bin;
+	size_t len;
+
+	s->free_total = s->free_largest = 0;
+	for (bin = 0; bin < MEM_REGION_FREE_BINS; bin++) {
+		list_for_each(&skiboot_heap.free_list[bin], f, list) {
+			len = f->hdr.num_longs * sizeof(long);
+			s->free_total += len;
+			if (len > s->free_largest)
+				s->free_largest = len;
+		}
+	}
+}
+
+static void account_alloc(struct trace_stats *s, void *p)
+{
+	unsigned long end;
+
+	s->live += mem_size(&skiboot_heap, p);
+	if (s->live > s->peak_live)
+		s->peak_live = s->live;
+
+	end = (unsigned long)p - sizeof(struct alloc_hdr)
+		+ mem_size(&skiboot_heap, p) - skiboot_heap.start;
+	if (end > s->high_water)
+		s->high_water = end;
+}
+
+static bool replay_op(const char *name, struct trace_stats *s,
+		      const struct trace_op *op)
+{
+	void **slot = &slots[op->slot];
+	uint64_t start, ns;
+	void *p;
+
+	if (*slot && op->op != 'r' && op->op != 'f') {
+		fprintf(stderr, "%s: slot %u already in use\n",
+			name, op->slot);
+		return false;
+	}
+	if (*slot)
+		s->live -= mem_size(&skiboot_heap, *slot);
+
+	start = now_ns();
+	switch (op->op) {
+	case 'a':
+		p = __malloc(op->size, __location__);
+		break;
+	case 'm':
+		p = __memalign(op->align, op->size, __location__);
+		break;
+	case 'r':
+		p = __realloc(*slot, op->size, __location__);
+		break;
+	case 'f':
+		__free(*slot, __location__);
+		p = NULL;
+		break;
+	default:
+		abort();
+	}
+	ns = now_ns() - start;
+
+	s->ops++;
+	s->total_ns += ns;
+	if (ns > s->worst_ns)
+		s->worst_ns = ns;
+
+	if (!p && op->op != 'f') {
+		fprintf(stderr, "%s: op %lu '%c' of %zu bytes failed\n",
+			name, s->ops, op->op, op->size);
+		return false;
+	}
+	*slot = p;
+	if (p)
+		account_alloc(s, p);
+	return true;
+}
+
+static bool replay(const char *name, const struct trace_op *ops,
+		   unsigned long num, struct trace_stats *s)
+{
+	unsigned long i;
+	bool ok = true;
+
+	for (i = 0; i < num && ok; i++)
+		ok = replay_op(name, s, &ops[i]);
+
+	/* Fragmentation as the trace left it */
+	free_space(s);
+
+	for (i = 0; i < MAX_SLOTS; i++) {
+		__free(slots[i], __location__);
+		slots[i] = NULL;
+	}
+	s->live = 0;
+
+	return ok;
+}
+
+static bool heap_empty(void)
+{
+	const struct alloc_hdr *h = region_start(&skiboot_heap);
+	return h->num_longs == skiboot_heap.len / sizeof(long);
+}
+
+int main(int argc, char *argv[])
+{
+	struct trace_stats s;
+	struct trace_op *ops;
+	unsigned long num, repeat = 1, r;
+	int i, ret = 0;
+
+	if (argc > 2 && strcmp(argv[1], "-r") == 0) {
+		repeat = strtoul(argv[2], NULL, 0);
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc < 2 || !repeat) {
+		fprintf(stderr, "Usage: %s [-r repeat] trace...\n", argv[0]);
+		return 1;
+	}
+
+	/* Use malloc for the heap, so valgrind can find issues. */
+	skiboot_heap.start = (unsigned long)real_malloc(skiboot_heap.len);
+
+	printf("%-24s %8s %10s %9s %8s %8s %6s\n", "trace", "ops",
+	       "ops/sec", "worst", "peak", "hwm", "frag");
+	for (i = 1; i < argc; i++) {
+		const char *name = strrchr(argv[i], '/');
+
+		name = name ? name + 1 : argv[i];
+		ops = load_trace(argv[i], &num);
+
+		memset(&s, 0, sizeof(s));
+		for (r = 0; r < repeat; r++) {
+			if (!replay(name, ops, num, &s)) {
+				ret = 1;
+				break;
+			}
+			assert(mem_check(&skiboot_heap));
+			assert(heap_empty());
+		}
+		real_free(ops);
+		if (!s.ops)
+			continue;
+
+		/*
+		 * Fragmentation is the share of free space which isn't in
+		 * the largest free block, at the end of the last replay.
+		 */
+		printf("%-24s %8lu %10.0f %7lluns %7zuK %7luK %5.1f%%\n",
+		       name, s.ops, s.ops * 1e9 / (s.total_ns ? : 1),
+		       (unsigned long long)s.worst_ns,
+		       s.peak_live / 1024, s.high_water / 1024,
+		       100.0 - 100.0 * s.free_largest / s.free_total);
+	}
+
+	assert(mem_region_lock.lock_val == 0);
+	real_free(region_start(&skiboot_heap));
+	return ret;
+}
@@ -24,6 +24,11 @@ static unsigned int cpu_max_pir = 1;
 struct cpu_thread {
 	unsigned int			chip_id;
 };
+static struct cpu_thread fake_cpu;
+static inline struct cpu_thread *this_cpu(void)
+{
+	return &fake_cpu;
+}
 
 #include <skiboot.h>
 
@@ -39,6 +44,7 @@ struct cpu_thread {
 #define TEST_HEAP_SIZE (1ULL << TEST_HEAP_ORDER)
 
 struct dt_node *dt_root;
+struct debug_descriptor debug_descriptor;
 
 void lock(struct lock *l)
 {
@@ -23,6 +23,11 @@ static unsigned int cpu_max_pir = 1;
 struct cpu_thread {
 	unsigned int			chip_id;
 };
+static struct cpu_thread fake_cpu;
+static inline struct cpu_thread *this_cpu(void)
+{
+	return &fake_cpu;
+}
 
 #include <stdlib.h>
 #include <string.h>
@@ -61,6 +66,7 @@ static void *__zalloc(size_t size, const char *location __attribute__((unused)))
 #include <stdio.h>
 
 struct dt_node *dt_root;
+struct debug_descriptor debug_descriptor;
 
 void lock(struct lock *l)
 {
@@ -87,6 +93,7 @@ int main(void)
 	void *p, *ptrs[100];
 	size_t i;
 	struct mem_region *r;
+	struct heap_stat *st;
 
 	/* Use malloc for the heap, so valgrind can find issues. */
 	test_heap = __malloc(TEST_HEAP_SIZE, __location__);
@@ -211,6 +218,27 @@ int main(void)
 	mem_free(&skiboot_heap, p, "freed");
 	assert(mem_check(&skiboot_heap));
 
+	/* Accounting follows the allocation site, including resizes. */
+	heap_stats_init(&skiboot_heap_stats);
+	ptrs[0] = mem_alloc(&skiboot_heap, 100, 1, "stats");
+	ptrs[1] = mem_alloc(&skiboot_heap, 100, 1, "stats");
+	st = heap_stat_find(&skiboot_heap_stats, "stats");
+	assert(st->allocs == 2 && st->frees == 0);
+	assert(st->cur_bytes == mem_size(&skiboot_heap, ptrs[0])
+	       + mem_size(&skiboot_heap, ptrs[1]));
+	assert(skiboot_heap_stats.histogram[6] == 2);
+	mem_free(&skiboot_heap, ptrs[0], "freed");
+	assert(st->frees == 1);
+	assert(st->peak_bytes == 2 * st->cur_bytes);
+	assert(mem_resize(&skiboot_heap, ptrs[1], 200, "stats resized"));
+	assert(st->cur_bytes == 0);
+	st = heap_stat_find(&skiboot_heap_stats, "stats resized");
+	assert(st->allocs == 0);
+	assert(st->cur_bytes == mem_size(&skiboot_heap, ptrs[1]));
+	mem_free(&skiboot_heap, ptrs[1], "freed");
+	assert(st->cur_bytes == 0 && st->frees == 1);
+	assert(heap_empty());
+
 	/* Test splitting of a region. */
 	r = new_region("base", (unsigned long)test_heap,
 		       TEST_HEAP_SIZE, NULL, REGION_SKIBOOT_HEAP);
@@ -229,7 +257,7 @@ int main(void)
 			assert(r->len == TEST_HEAP_SIZE/2);
 			assert(strcmp(r->name, "splitter") == 0);
 			assert(r->type == REGION_RESERVED);
-			assert(!r->free_list.n.next);
+			assert(!r->free_list[0].n.next);
 		} else if (region_start(r) == test_heap + TEST_HEAP_SIZE/4*3) {
 			assert(r->len == TEST_HEAP_SIZE/4);
 			assert(strcmp(r->name, "base") == 0);
@@ -240,6 +268,10 @@ int main(void)
 		i++;
 	}
 	assert(i == 3);
+	i = 0;
+	for (r = mem_region_next(NULL); r; r = mem_region_next(r))
+		i++;
+	assert(i == 3);
 	while ((r = list_pop(&regions, struct mem_region, list)) != NULL) {
 		list_del(&r->list);
 		mem_free(&skiboot_heap, r, __location__);
@@ -0,0 +1,173 @@
+/* Copyright 2013-2014 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <config.h>
+
+#define BITS_PER_LONG (sizeof(long) * 8)
+/* Don't include this, it's PPC-specific */
+#define __CPU_H
+static unsigned int cpu_max_pir = 1;
+struct cpu_thread {
+	unsigned int			chip_id;
+};
+static struct cpu_thread fake_cpu;
+static inline struct cpu_thread *this_cpu(void)
+{
+	return &fake_cpu;
+}
+
+#include <stdlib.h>
+
+/* Use these before we undefine them below. */
+static inline void *real_malloc(size_t size)
+{
+	return malloc(size);
+}
+
+static inline void real_free(void *p)
+{
+	return free(p);
+}
+
+#include <skiboot.h>
+
+/* We need mem_region to accept __location__ */
+#define is_rodata(p) true
+#include "../malloc.c"
+#include "../mem_region.c"
+#include "../device.c"
+
+#include <assert.h>
+#include <stdio.h>
+
+char __rodata_start[1], __rodata_end[1];
+struct dt_node *dt_root;
+struct debug_descriptor debug_descriptor;
+
+void lock(struct lock *l)
+{
+	assert(!l->lock_val);
+	l->lock_val = 1;
+}
+
+void unlock(struct lock *l)
+{
+	assert(l->lock_val);
+	l->lock_val = 0;
+}
+
+#define TEST_HEAP_SIZE		(1024 * 1024)
+#define TEST_NODE_SIZE		(CHIP_HEAP_SIZE * 4)
+#define TEST_CHIP		3
+
+/* The chip heap only holds its own accounting table when empty */
+static bool region_empty(const struct mem_region *r)
+{
+	const struct alloc_hdr *h = region_start(r);
+
+	assert((void *)r->stats == (void *)(h + 1));
+	h = (void *)h + h->num_longs * sizeof(long);
+	return h->num_longs == r->len / sizeof(long)
+		- mem_size(r, r->stats) / sizeof(long);
+}
+
+int main(void)
+{
+	struct dt_node *mem;
+	struct mem_region *node, *heap;
+	char *node_mem;
+	struct heap_stat *st;
+	void *p, *p2, *objs[8];
+	unsigned int i;
+
+	skiboot_heap.start = (unsigned long)real_malloc(TEST_HEAP_SIZE);
+	skiboot_heap.len = TEST_HEAP_SIZE;
+
+	dt_root = dt_new_root("");
+	mem = dt_new(dt_root, "memory");
+	dt_add_property_cells(mem, "ibm,chip-id", TEST_CHIP);
+
+	/* A memory node region for our chip. */
+	node_mem = real_malloc(TEST_NODE_SIZE);
+	node = new_region("node", (unsigned long)node_mem, TEST_NODE_SIZE,
+			  mem, REGION_SKIBOOT_HEAP);
+	list_add(&regions, &node->list);
+
+	mem_region_init_chip_heaps();
+	assert(chip_heaps[TEST_CHIP]);
+	assert(!chip_heaps[0]);
+	heap = &chip_heaps[TEST_CHIP]->region;
+	assert(region_start(heap) >= (void *)node_mem);
+	assert(region_start(heap) + heap->len <= (void *)node_mem
+	       + TEST_NODE_SIZE);
+	assert(mem_check(node));
+	assert(heap->stats);
+	assert(debug_descriptor.num_heap_stats == 1);
+	assert(debug_descriptor.heap_stats_phys[0] == (uint64_t)heap->stats);
+
+	/* Allocations on our chip come from its heap. */
+	fake_cpu.chip_id = TEST_CHIP;
+	p = malloc(100);
+	assert(in_region(heap, p));
+	assert(mem_heap_size(p) == mem_size(heap, p));
+	st = heap_stat_find(heap->stats, ((struct alloc_hdr *)p)[-1].location);
+	assert(st->allocs == 1 && st->cur_bytes == mem_size(heap, p));
+	assert(!mem_region_lock.lock_val);
+	assert(!chip_heaps[TEST_CHIP]->lock.lock_val);
+
+	/* Freeing from another chip finds the right heap. */
+	fake_cpu.chip_id = 0;
+	free(p);
+	assert(region_empty(heap));
+
+	/* Batches come from the local heap, and go back to theirs. */
+	fake_cpu.chip_id = TEST_CHIP;
+	assert(mem_heap_alloc_batch(64, 8, objs, 4, __location__) == 4);
+	fake_cpu.chip_id = 0;
+	assert(mem_heap_alloc_batch(64, 8, objs + 4, 4, __location__) == 4);
+	for (i = 0; i < 8; i++)
+		assert(in_region(i < 4 ? heap : &skiboot_heap, objs[i]));
+	mem_heap_free_batch(objs, 8, __location__);
+	assert(region_empty(heap));
+	assert(mem_check(&skiboot_heap));
+	assert(!mem_region_lock.lock_val);
+	assert(!chip_heaps[TEST_CHIP]->lock.lock_val);
+
+	/* Other chips fall back to remote chip heaps. */
+	p = malloc(100);
+	assert(in_region(heap, p));
+
+	/* Realloc can grow in place... */
+	p2 = realloc(p, 200);
+	assert(p2 == p);
+
+	/* ... or move to skiboot_heap once the chip heap is full. */
+	p = malloc(CHIP_HEAP_SIZE - mem_size(heap, heap->stats) - 1024);
+	assert(in_region(heap, p));
+	p2 = realloc(p2, 4096);
+	assert(in_region(&skiboot_heap, p2));
+	assert(mem_check(heap));
+	assert(mem_check(&skiboot_heap));
+	free(p);
+	free(p2);
+	assert(region_empty(heap));
+	assert(mem_check(&skiboot_heap));
+	assert(!mem_region_lock.lock_val);
+
+	real_free(node_mem);
+	real_free(region_start(&skiboot_heap));
+	return 0;
+}
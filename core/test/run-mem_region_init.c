@@ -23,6 +23,11 @@ static unsigned int cpu_max_pir = 1;
 struct cpu_thread {
 	unsigned int			chip_id;
 };
+static struct cpu_thread fake_cpu;
+static inline struct cpu_thread *this_cpu(void)
+{
+	return &fake_cpu;
+}
 
 #include <stdlib.h>
 
@@ -63,6 +68,8 @@ static inline char *skiboot_strdup(const char *str)
 #include <assert.h>
 #include <stdio.h>
 
+struct debug_descriptor debug_descriptor;
+
 void lock(struct lock *l)
 {
 	assert(!l->lock_val);
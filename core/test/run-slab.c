@@ -0,0 +1,157 @@
+/* Copyright 2013-2014 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <config.h>
+
+#define BITS_PER_LONG (sizeof(long) * 8)
+
+#include <stdlib.h>
+#include <slab.h>
+
+/* Don't include this, it's PPC-specific */
+#define __CPU_H
+static unsigned int cpu_max_pir = 1;
+struct cpu_thread {
+	unsigned int			chip_id;
+	struct slab_magazine		*slab_mags[SLAB_MAX_CACHES];
+};
+static struct cpu_thread *this_cpu(void);
+
+#include <skiboot.h>
+
+#define is_rodata(p) true
+
+#include "../mem_region.c"
+#include "../malloc.c"
+#include "../slab.c"
+#include "../device.c"
+
+#include "mem_region-malloc.h"
+
+#define TEST_HEAP_ORDER 16
+#define TEST_HEAP_SIZE (1ULL << TEST_HEAP_ORDER)
+
+#define NUM_CPUS 2
+#define NUM_OBJS 100
+
+struct dt_node *dt_root;
+struct debug_descriptor debug_descriptor;
+
+static char test_heap[TEST_HEAP_SIZE] __attribute__((aligned(16)));
+static struct cpu_thread cpus[NUM_CPUS], *current;
+
+static struct cpu_thread *this_cpu(void)
+{
+	return current;
+}
+
+static unsigned int heap_locks;
+
+void lock(struct lock *l)
+{
+	assert(!l->lock_val);
+	l->lock_val = 1;
+	if (l == &mem_region_lock)
+		heap_locks++;
+}
+
+void unlock(struct lock *l)
+{
+	assert(l->lock_val);
+	l->lock_val = 0;
+}
+
+struct test_obj {
+	unsigned long a, b, c;
+};
+
+static DEFINE_SLAB_CACHE(test_cache, struct test_obj);
+
+static bool heap_empty(void)
+{
+	const struct alloc_hdr *h = region_start(&skiboot_heap);
+	return h->num_longs == skiboot_heap.len / sizeof(long);
+}
+
+int main(void)
+{
+	struct test_obj *objs[NUM_OBJS], *o;
+	unsigned int i, locks;
+
+	skiboot_heap.start = (unsigned long)test_heap;
+	skiboot_heap.len = TEST_HEAP_SIZE;
+	current = &cpus[0];
+
+	/* First allocation creates the magazine and refills it. */
+	o = slab_zalloc(&test_cache);
+	assert(o);
+	assert(!o->a && !o->b && !o->c);
+	assert(test_cache.index == 0);
+	assert(cpus[0].slab_mags[0]);
+	assert(!cpus[1].slab_mags[0]);
+	assert(!mem_region_lock.lock_val);
+
+	/* Freeing and reallocating stays local and LIFO. */
+	locks = heap_locks;
+	slab_free(&test_cache, o);
+	assert(slab_alloc(&test_cache) == o);
+	assert(heap_locks == locks);
+	slab_free(&test_cache, o);
+
+	/* Lots of objects: the heap is only hit once per batch. */
+	locks = heap_locks;
+	for (i = 0; i < NUM_OBJS; i++) {
+		objs[i] = slab_alloc(&test_cache);
+		assert(objs[i]);
+		objs[i]->a = i;
+	}
+	assert(heap_locks - locks <= NUM_OBJS / SLAB_BATCH + 1);
+	assert(mem_check(&skiboot_heap));
+
+	/* Free half of them from another CPU. */
+	current = &cpus[1];
+	locks = heap_locks;
+	for (i = 0; i < NUM_OBJS / 2; i++) {
+		assert(objs[i]->a == i);
+		slab_free(&test_cache, objs[i]);
+	}
+	assert(cpus[1].slab_mags[0]);
+	assert(cpus[1].slab_mags[0]->count <= SLAB_MAG_SIZE);
+	/* One lock for the magazine itself, then one per batch. */
+	assert(heap_locks - locks <= NUM_OBJS / 2 / SLAB_BATCH + 1);
+
+	/* And the rest back on the first one. */
+	current = &cpus[0];
+	for (i = NUM_OBJS / 2; i < NUM_OBJS; i++)
+		slab_free(&test_cache, objs[i]);
+	assert(cpus[0].slab_mags[0]->count <= SLAB_MAG_SIZE);
+	assert(mem_check(&skiboot_heap));
+	assert(!mem_region_lock.lock_val);
+
+	/* Drain the magazines, and the heap must be empty. */
+	for (i = 0; i < NUM_CPUS; i++) {
+		current = &cpus[i];
+		locks = heap_locks;
+		slab_drain();
+		assert(!cpus[i].slab_mags[0]->count);
+		assert(heap_locks - locks <= 1);
+		free(cpus[i].slab_mags[0]);
+	}
+	assert(heap_empty());
+	assert(!mem_region_lock.lock_val);
+
+	return 0;
+}
@@ -0,0 +1,294 @@
+/* Copyright 2013-2014 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Stress the reader against writers coalescing repeats in place.
+ *
+ * Each child writes runs of identical records, where the k'th copy of
+ * a run is stamped with the run's first timestamp plus k. So every
+ * repeat record must carry the first timestamp plus the number of
+ * repeats so far, and a torn copy of one shows up as a mismatch.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <sched.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+/* Don't include these: PPC-specific */
+#define __CPU_H
+#define __TIME_H
+#define __PROCESSOR_H
+
+#if defined(__i386__) || defined(__x86_64__)
+/* This is more than a lwsync, but it'll work */
+static void full_barrier(void)
+{
+	asm volatile("mfence" : : : "memory");
+}
+#define lwsync full_barrier
+#define sync full_barrier
+#else
+#error "Define sync & lwsync for this arch"
+#endif
+
+#define zalloc(size) calloc((size), 1)
+
+struct cpu_thread {
+	uint32_t pir;
+	uint32_t chip_id;
+	struct trace_info *trace;
+	int server_no;
+	bool is_secondary;
+	struct cpu_thread *primary;
+};
+static struct cpu_thread *this_cpu(void);
+
+#define CPUS 4
+
+static struct cpu_thread fake_cpus[CPUS];
+
+static inline struct cpu_thread *next_cpu(struct cpu_thread *cpu)
+{
+	if (cpu == NULL)
+		return &fake_cpus[0];
+	cpu++;
+	if (cpu == &fake_cpus[CPUS])
+		return NULL;
+	return cpu;
+}
+
+#define first_cpu() next_cpu(NULL)
+
+#define for_each_cpu(cpu)	\
+	for (cpu = first_cpu(); cpu; cpu = next_cpu(cpu))
+
+static unsigned long timestamp;
+static unsigned long mftb(void)
+{
+	return timestamp;
+}
+
+/* Carve the buffers from a shared mapping, so the children can write */
+static void *shared_mem;
+static size_t shared_len, shared_used;
+
+static void *local_alloc(unsigned int chip_id,
+			 size_t size, size_t align)
+{
+	void *p;
+
+	(void)chip_id;
+	shared_used = (shared_used + align - 1) & ~(align - 1);
+	assert(shared_used + size <= shared_len);
+	p = shared_mem + shared_used;
+	shared_used += size;
+	return p;
+}
+
+struct dt_node;
+extern struct dt_node *opal_node;
+
+#include "../trace.c"
+
+#define rmb() lwsync()
+
+#include "../external/trace.c"
+#include "../device.c"
+
+char __rodata_start[1], __rodata_end[1];
+struct dt_node *opal_node;
+struct debug_descriptor debug_descriptor = {
+	.trace_mask = -1
+};
+
+void lock(struct lock *l)
+{
+	assert(!l->lock_val);
+	l->lock_val = 1;
+}
+
+void unlock(struct lock *l)
+{
+	assert(l->lock_val);
+	l->lock_val = 0;
+}
+
+struct cpu_thread *my_fake_cpu;
+static struct cpu_thread *this_cpu(void)
+{
+	return my_fake_cpu;
+}
+
+#define RUNS		20000
+#define LONG_RUN	(0xFFFF + 100)
+#define TYPE_RUN	3
+#define TYPE_DONE	0x70
+
+/* Run lengths vary, with the odd one long enough to fill a repeat. */
+static unsigned int run_len(unsigned int run)
+{
+	if (run % 5000 == 4999)
+		return LONG_RUN;
+	return 1 + (run * 7) % 200;
+}
+
+static void write_runs(int id)
+{
+	void exit(int);
+	unsigned int run, k, len;
+	union trace trace;
+
+	timestamp = 0;
+	for (run = 0; run < RUNS; run++) {
+		len = run_len(run);
+		for (k = 0; k < len; k++) {
+			/* Rewritten each time, as trace_add() fills in hdr */
+			trace.opal.token = run;
+			trace.opal.lr = ~(u64)run;
+			trace.opal.sp = id;
+			timestamp++;
+			trace_add(&trace, TYPE_RUN, sizeof(trace.opal));
+		}
+	}
+
+	/* Final entry has special type, so parent knows it's over. */
+	trace_add(&trace, TYPE_DONE, sizeof(trace.hdr));
+	exit(0);
+}
+
+struct reader_state {
+	bool done, in_run;
+	u64 run, run_ts, seen;
+	unsigned long records, repeats;
+};
+
+static void check_trace(struct reader_state *r, const union trace *t)
+{
+	switch (t->hdr.type) {
+	case TRACE_OVERFLOW:
+		/* We may have lost the start of a run. */
+		r->in_run = false;
+		break;
+	case TRACE_REPEAT:
+		assert(t->repeat.num != 0);
+		assert(t->repeat.prev_len == sizeof(t->opal));
+		r->repeats += t->repeat.num;
+		if (!r->in_run)
+			break;
+		r->seen += t->repeat.num;
+		/* The heart of it: num and timestamp must agree */
+		assert(t->repeat.timestamp == r->run_ts + r->seen);
+		assert(r->seen < run_len(r->run));
+		break;
+	case TYPE_RUN:
+		/* Records are never torn either */
+		assert(t->opal.lr == ~t->opal.token);
+		assert(t->opal.token < RUNS);
+		/* Full repeats start a new record within the same run */
+		if (r->in_run && t->opal.token == r->run)
+			assert(t->hdr.timestamp == r->run_ts + r->seen + 1);
+		r->in_run = true;
+		r->run = t->opal.token;
+		r->run_ts = t->hdr.timestamp;
+		r->seen = 0;
+		r->records++;
+		break;
+	case TYPE_DONE:
+		r->done = true;
+		break;
+	default:
+		assert(0);
+	}
+}
+
+int main(void)
+{
+	struct reader_state state[CPUS] = { };
+	unsigned int i, done = 0, last = 0;
+
+	/* Use a shared mmap to test actual parallel buffers. */
+	shared_len = CPUS * ALIGN_UP(sizeof(struct trace_info)
+				     + TBUF_SZ + MAX_SIZE, 0x1000);
+	shared_mem = mmap(NULL, shared_len, PROT_READ|PROT_WRITE,
+			  MAP_ANONYMOUS|MAP_SHARED, -1, 0);
+	assert(shared_mem != MAP_FAILED);
+
+	opal_node = dt_new_root("opal");
+	for (i = 0; i < CPUS; i++) {
+		fake_cpus[i].server_no = i;
+		fake_cpus[i].is_secondary = (i & 0x1);
+		fake_cpus[i].primary = &fake_cpus[i & ~0x1];
+	}
+	init_trace_buffers();
+
+	for (i = 0; i < CPUS; i++) {
+		if (!fork()) {
+			/* Child. */
+			my_fake_cpu = &fake_cpus[i];
+			write_runs(i);
+		}
+	}
+
+	while (done < CPUS) {
+		union trace t;
+
+		for (i = 0; i < CPUS; i++) {
+			if (state[(i+last) % CPUS].done)
+				continue;
+			if (trace_get(&t, &fake_cpus[(i+last) % CPUS].trace->tb))
+				break;
+		}
+
+		if (i == CPUS) {
+			sched_yield();
+			continue;
+		}
+		i = (i + last) % CPUS;
+		last = i;
+
+		if (t.hdr.type != TRACE_OVERFLOW)
+			assert(t.hdr.cpu == i);
+		check_trace(&state[i], &t);
+		if (state[i].done)
+			done++;
+	}
+
+	/* Gather children. */
+	for (i = 0; i < CPUS; i++) {
+		int status;
+		wait(&status);
+		assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+
+	for (i = 0; i < CPUS; i++) {
+		printf("Child %u: %lu records, %lu repeats, %llu lost\n", i,
+		       state[i].records, state[i].repeats,
+		       (long long)fake_cpus[i].trace->tb.lost);
+		assert(state[i].records);
+	}
+
+	dt_free(opal_node);
+	munmap(shared_mem, shared_len);
+	return 0;
+}
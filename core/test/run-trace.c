@@ -163,8 +163,10 @@ static void test_parallel(void)
 	void *p;
 	unsigned int i, counts[CPUS] = { 0 }, overflows[CPUS] = { 0 };
 	unsigned int repeats[CPUS] = { 0 }, num_overflows[CPUS] = { 0 };
-	bool done[CPUS] = { false };
-	size_t len = sizeof(struct trace_info) + TBUF_SZ + sizeof(union trace);
+	bool done[CPUS] = { false }, missed[CPUS] = { false };
+	u64 last_ts[CPUS] = { 0 };
+	size_t len = ALIGN_UP(sizeof(struct trace_info) + TBUF_SZ + MAX_SIZE,
+			      8);
 	int last = 0;
 
 	/* Use a shared mmap to test actual parallel buffers. */
@@ -174,8 +176,9 @@ static void test_parallel(void)
 
 	for (i = 0; i < CPUS; i++) {
 		fake_cpus[i].trace = p + i * len;
+		fake_cpus[i].trace->tb.version = TRACEBUF_VERSION;
 		fake_cpus[i].trace->tb.mask = TBUF_SZ - 1;
-		fake_cpus[i].trace->tb.max_size = sizeof(union trace);
+		fake_cpus[i].trace->tb.max_size = MAX_SIZE;
 		fake_cpus[i].is_secondary = false;
 	}
 
@@ -202,18 +205,27 @@ static void test_parallel(void)
 		i = (i + last) % CPUS;
 		last = i;
 
-		assert(t.hdr.cpu < CPUS);
-		assert(!done[t.hdr.cpu]);
+		/* Overflow records don't have a cpu. */
+		assert(!done[i]);
 
 		if (t.hdr.type == TRACE_OVERFLOW) {
-			/* Conveniently, each record is 16 bytes here. */
-			assert(t.overflow.bytes_missed % 16 == 0);
-			overflows[i] += t.overflow.bytes_missed / 16;
+			assert(t.overflow.bytes_missed);
+			overflows[i] += t.overflow.bytes_missed;
 			num_overflows[i]++;
+			missed[i] = true;
 			continue;
 		}
 
 		assert(t.hdr.timestamp % CPUS == t.hdr.cpu);
+		assert(t.hdr.cpu == i);
+		/* Child 0 writes every CPUS ticks, and never repeats. */
+		if (i == 0 && last_ts[0] && !missed[0] && t.hdr.type != 0x70)
+			assert(t.hdr.timestamp == last_ts[0] + CPUS);
+		if (t.hdr.type != TRACE_REPEAT) {
+			assert(t.hdr.timestamp >= last_ts[i]);
+			last_ts[i] = t.hdr.timestamp;
+			missed[i] = false;
+		}
 		if (t.hdr.type == TRACE_REPEAT) {
 			assert(t.hdr.len_div_8 * 8 == sizeof(t.repeat));
 			assert(t.repeat.num != 0);
@@ -233,20 +245,19 @@ static void test_parallel(void)
 	}
 
 	for (i = 0; i < CPUS; i++) {
-		printf("Child %i: %u produced, %u overflows, %llu total\n", i,
+		printf("Child %i: %u produced, %u bytes missed, %llu total\n", i,
 		       counts[i], overflows[i],
 		       (long long)fake_cpus[i].trace->tb.end);
 		assert(counts[i] + repeats[i] <= PER_CHILD_TRACES);
 	}
 	/* Child 0 never repeats. */
 	assert(repeats[0] == 0);
-	assert(counts[0] + overflows[0] == PER_CHILD_TRACES);
+	assert(counts[0] == PER_CHILD_TRACES || num_overflows[0]);
 
 	/*
-	 * FIXME: Other children have some fuzz, since overflows may
-	 * include repeat record we already read.  And odd-numbered
-	 * overflows may include more repeat records than normal
-	 * records (they alternate).
+	 * Records are variable length, so overflows only tell us the
+	 * bytes missed, not how many records; but above we checked
+	 * child 0's stream has no gaps besides those.
 	 */
 }
 
@@ -255,7 +266,7 @@ int main(void)
 	union trace minimal;
 	union trace large;
 	union trace trace;
-	unsigned int i, j;
+	unsigned int i, j, k;
 
 	opal_node = dt_new_root("opal");
 	for (i = 0; i < CPUS; i++) {
@@ -266,7 +277,13 @@ int main(void)
 	init_trace_buffers();
 	my_fake_cpu = &fake_cpus[0];
 
+	/* Secondaries get their own buffer, and nobody needs the lock. */
 	for (i = 0; i < CPUS; i++) {
+		assert(fake_cpus[i].trace);
+		assert(!fake_cpus[i].trace->shared);
+		assert(fake_cpus[i].trace->tb.version == TRACEBUF_VERSION);
+		if (fake_cpus[i].is_secondary)
+			assert(fake_cpus[i].trace != fake_cpus[i].primary->trace);
 		assert(trace_empty(&fake_cpus[i].trace->tb));
 		assert(!trace_get(&trace, &fake_cpus[i].trace->tb));
 	}
@@ -278,23 +295,56 @@ int main(void)
 	assert(trace.hdr.len_div_8 == minimal.hdr.len_div_8);
 	assert(trace.hdr.timestamp == timestamp);
 
-	/* Make it wrap once. */
-	for (i = 0; i < TBUF_SZ / (minimal.hdr.len_div_8 * 8) + 1; i++) {
+	/* Make it wrap once: lose the record we read, and one we didn't. */
+	for (i = 0; my_fake_cpu->trace->tb.lost < 2; i++) {
 		timestamp = i;
 		trace_add(&minimal, 99 + (i%2), sizeof(trace.hdr));
 	}
+	/* Bare headers shrink from 16 to 4 bytes, besides sync records */
+	assert(i > 3 * TBUF_SZ / (minimal.hdr.len_div_8 * 8));
 
 	assert(trace_get(&trace, &my_fake_cpu->trace->tb));
 	/* First one must be overflow marker. */
 	assert(trace.hdr.type == TRACE_OVERFLOW);
 	assert(trace.hdr.len_div_8 * 8 == sizeof(trace.overflow));
-	assert(trace.overflow.bytes_missed == minimal.hdr.len_div_8 * 8);
+	/* The one we missed, and up to the next absolute timestamp. */
+	assert(trace.overflow.bytes_missed > 0);
+	assert(trace.overflow.bytes_missed <= SYNC_INTERVAL + MAX_SIZE);
+	/* The writer threw away the one we read, and the one we missed. */
+	assert(my_fake_cpu->trace->tb.lost == 2);
 
-	for (i = 0; i < TBUF_SZ / (minimal.hdr.len_div_8 * 8); i++) {
-		assert(trace_get(&trace, &my_fake_cpu->trace->tb));
+	assert(trace_get(&trace, &my_fake_cpu->trace->tb));
+	k = trace.hdr.timestamp;
+	do {
 		assert(trace.hdr.len_div_8 == minimal.hdr.len_div_8);
-		assert(trace.hdr.timestamp == i+1);
-		assert(trace.hdr.type == 99 + ((i+1)%2));
+		assert(trace.hdr.timestamp == k++);
+		assert(trace.hdr.type == 99 + (trace.hdr.timestamp % 2));
+		assert(trace.hdr.cpu == my_fake_cpu->server_no);
+	} while (trace_get(&trace, &my_fake_cpu->trace->tb));
+	assert(k == i);
+
+	/* OPAL calls, with arguments varying like Linux's: 26 bytes vs 64 */
+	j = my_fake_cpu->trace->tb.end;
+	for (i = 0; i < 1000; i++) {
+		timestamp += 1000 + i % 300;
+		minimal.opal.token = i % 120;
+		minimal.opal.lr = 0xc00000000000a1b8ULL;
+		minimal.opal.sp = 0xc0000003c5f7bd30ULL - (i % 4) * 0x80;
+		minimal.opal.r3_to_11[0] = i;
+		minimal.opal.r3_to_11[1] = 0x3fe4a0000ULL + i * 0x100;
+		minimal.opal.r3_to_11[2] = 0;
+		trace_add(&minimal, TRACE_OPAL,
+			  offsetof(struct trace_opal, r3_to_11[3]));
+	}
+	j = my_fake_cpu->trace->tb.end - j;
+	assert(j * 2 < i * offsetof(struct trace_opal, r3_to_11[3]));
+	for (i = 0; i < 1000; i++) {
+		assert(trace_get(&trace, &my_fake_cpu->trace->tb));
+		assert(trace.hdr.type == TRACE_OPAL);
+		assert(trace.opal.token == i % 120);
+		assert(trace.opal.lr == 0xc00000000000a1b8ULL);
+		assert(trace.opal.r3_to_11[1] == 0x3fe4a0000ULL + i * 0x100);
+		assert(trace.opal.r3_to_11[2] == 0);
 	}
 	assert(!trace_get(&trace, &my_fake_cpu->trace->tb));
 
@@ -377,8 +427,7 @@ int main(void)
 	}
 
 	for (i = 0; i < CPUS; i++)
-		if (!fake_cpus[i].is_secondary)
-			free(fake_cpus[i].trace);
+		free(fake_cpus[i].trace);
 
 	test_parallel();
 
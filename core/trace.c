@@ -27,7 +27,12 @@
 
 #define DEBUG_TRACES
 
-#define MAX_SIZE (sizeof(union trace) + 7)
+/* Largest compact record: header, timestamp, cpu and every payload byte */
+#define MAX_SIZE (3 + 10 + 3 + \
+		  (sizeof(union trace) - sizeof(struct trace_hdr)) / 8 * 9)
+
+/* How often (in bytes) we write an absolute timestamp for readers */
+#define SYNC_INTERVAL 1024
 
 /* Smaller trace buffer for early booting */
 #define BOOT_TBUF_SZ 65536
@@ -37,7 +42,9 @@ static struct {
 } boot_tracebuf __section(".data.boot_trace") = {
 	.trace_info = {
 		.lock = LOCK_UNLOCKED,
+		.shared = false,
 		.tb = {
+			.version = TRACEBUF_VERSION,
 		        .mask = BOOT_TBUF_SZ - 1,
 			.max_size = MAX_SIZE
 		},
@@ -56,23 +63,111 @@ static size_t tracebuf_extra(void)
 	return TBUF_SZ + MAX_SIZE;
 }
 
+static u8 *put_varint(u8 *p, u64 val)
+{
+	while (val >= 0x80) {
+		*(p++) = val | 0x80;
+		val >>= 7;
+	}
+	*(p++) = val;
+	return p;
+}
+
+static void put_be(u8 *p, u64 val, unsigned int bytes)
+{
+	while (bytes--) {
+		p[bytes] = val;
+		val >>= 8;
+	}
+}
+
+static u64 get_be(const u8 *p, unsigned int bytes)
+{
+	u64 val = 0;
+
+	while (bytes--)
+		val = (val << 8) | *(p++);
+	return val;
+}
+
+/* Offset of the payload words in a compact record */
+static unsigned int payload_offset(const u8 *rec)
+{
+	const u8 *p = rec + 3;
+
+	while (*(p++) & 0x80);
+	if (rec[2] & TRACE_F_CPU)
+		while (*(p++) & 0x80);
+	return p - rec;
+}
+
+/* Compact @trace into @rec, returning its length. */
+static unsigned int trace_encode(struct trace_info *ti,
+				 const union trace *trace, u8 *rec)
+{
+	const u8 *src = (const u8 *)(&trace->hdr + 1);
+	unsigned int i, j, words;
+	u8 *p = rec + 3, *mask;
+	s64 delta;
+
+	words = trace->hdr.len_div_8 - sizeof(trace->hdr) / 8;
+	rec[0] = trace->hdr.type;
+	rec[2] = words << 4;
+
+	if (ti->tb.end >= ti->next_sync) {
+		rec[2] |= TRACE_F_SYNC | TRACE_F_CPU;
+		p = put_varint(p, trace->hdr.timestamp);
+	} else {
+		/* Zigzag, in case the timebase was stepped back */
+		delta = trace->hdr.timestamp - ti->last_tb;
+		p = put_varint(p, ((u64)delta << 1) ^ (u64)(delta >> 63));
+		if (trace->hdr.cpu != ti->last_cpu)
+			rec[2] |= TRACE_F_CPU;
+	}
+	if (rec[2] & TRACE_F_CPU)
+		p = put_varint(p, trace->hdr.cpu);
+
+	for (i = 0; i < words; i++, src += 8) {
+		mask = p++;
+		*mask = 0;
+		for (j = 0; j < 8; j++) {
+			if (src[j]) {
+				*mask |= 1 << j;
+				*(p++) = src[j];
+			}
+		}
+	}
+	rec[1] = p - rec;
+	return rec[1];
+}
+
 /* To avoid bloating each entry, repeats are actually specific entries.
  * tb->last points to the last (non-repeat) entry. */
-static bool handle_repeat(struct tracebuf *tb, const union trace *trace)
+static bool handle_repeat(struct trace_info *ti, const union trace *trace,
+			  const u8 *rec, unsigned int rsz)
 {
-	struct trace_hdr *prev;
-	struct trace_repeat *rpt;
-	u32 len;
+	struct tracebuf *tb = &ti->tb;
+	const u8 *prev;
+	u8 *rpt;
+	unsigned int len, off, poff;
+	u16 num;
+
+	/* Nothing written yet? */
+	if (tb->end == tb->last)
+		return false;
 
 	prev = (void *)tb->buf + (tb->last & tb->mask);
+	len = prev[1];
 
-	if (prev->type != trace->hdr.type
-	    || prev->len_div_8 != trace->hdr.len_div_8
-	    || prev->cpu != trace->hdr.cpu)
+	if (prev[0] != rec[0]
+	    || TRACE_F_WORDS(prev[2]) != TRACE_F_WORDS(rec[2])
+	    || ti->last_cpu != trace->hdr.cpu)
 		return false;
 
-	len = prev->len_div_8 << 3;
-	if (memcmp(prev + 1, &trace->hdr + 1, len - sizeof(*prev)) != 0)
+	/* Compare the encoded payloads, they're the same if the words are */
+	poff = payload_offset(prev);
+	off = payload_offset(rec);
+	if (len - poff != rsz - off || memcmp(prev + poff, rec + off, rsz - off))
 		return false;
 
 	/* If they've consumed prev entry, don't repeat. */
@@ -81,42 +176,48 @@ static bool handle_repeat(struct tracebuf *tb, const union trace *trace)
 
 	/* OK, it's a duplicate.  Do we already have repeat? */
 	if (tb->last + len != tb->end) {
-		/* FIXME: Reader is not protected from seeing this! */
 		rpt = (void *)tb->buf + ((tb->last + len) & tb->mask);
-		assert(tb->last + len + rpt->len_div_8*8 == tb->end);
-		assert(rpt->type == TRACE_REPEAT);
+		assert(tb->last + len + rpt[1] == tb->end);
+		assert(rpt[0] == TRACE_REPEAT);
 
 		/* If this repeat entry is full, don't repeat. */
-		if (rpt->num == 0xFFFF)
+		num = get_be(rpt + 4, 2);
+		if (num == 0xFFFF)
 			return false;
 
-		rpt->num++;
-		rpt->timestamp = trace->hdr.timestamp;
+		/*
+		 * The reader may be copying it right now, so bracket the
+		 * update with repeat_seq: it retries if that was odd or
+		 * moved under it, and never sees num and timestamp
+		 * disagree.
+		 */
+		tb->repeat_seq++;
+		lwsync(); /* write barrier: mark busy before the update */
+		put_be(rpt + 4, num + 1, 2);
+		put_be(rpt + 6, trace->hdr.timestamp, 8);
+		lwsync(); /* write barrier: complete update before unmarking */
+		tb->repeat_seq++;
 		return true;
 	}
 
-	/*
-	 * Generate repeat entry: it's the smallest possible entry, so we
-	 * must have eliminated old entries.
-	 */
-	assert(trace->hdr.len_div_8 * 8 >= sizeof(*rpt));
-
+	/* Generate repeat entry: trace_add() made room for it. */
 	rpt = (void *)tb->buf + (tb->end & tb->mask);
-	rpt->timestamp = trace->hdr.timestamp;
-	rpt->type = TRACE_REPEAT;
-	rpt->len_div_8 = sizeof(*rpt) >> 3;
-	rpt->cpu = trace->hdr.cpu;
-	rpt->prev_len = trace->hdr.len_div_8 << 3;
-	rpt->num = 1;
+	rpt[0] = TRACE_REPEAT;
+	rpt[1] = TRACE_REPEAT_LEN;
+	rpt[2] = 0;
+	rpt[3] = trace->hdr.len_div_8;
+	put_be(rpt + 4, 1, 2);
+	put_be(rpt + 6, trace->hdr.timestamp, 8);
 	lwsync(); /* write barrier: complete repeat record before exposing */
-	tb->end += sizeof(*rpt);
+	tb->end += TRACE_REPEAT_LEN;
 	return true;
 }
 
 void trace_add(union trace *trace, u8 type, u16 len)
 {
 	struct trace_info *ti = this_cpu()->trace;
-	unsigned int tsz;
+	unsigned int tsz, rsz, room;
+	u8 rec[MAX_SIZE];
 
 	trace->hdr.type = type;
 	trace->hdr.len_div_8 = (len + 7) >> 3;
@@ -136,28 +237,44 @@ void trace_add(union trace *trace, u8 type, u16 len)
 	trace->hdr.timestamp = mftb();
 	trace->hdr.cpu = this_cpu()->server_no;
 
-	lock(&ti->lock);
+	/*
+	 * Each thread normally owns its buffer, so there's nobody to
+	 * race with but the reader. Only a buffer we fell back to
+	 * sharing needs the lock.
+	 */
+	if (ti->shared)
+		lock(&ti->lock);
+
+	rsz = trace_encode(ti, trace, rec);
 
 	/* Throw away old entries before we overwrite them. */
-	while ((ti->tb.start + ti->tb.mask + 1) < (ti->tb.end + tsz)) {
-		struct trace_hdr *hdr;
+	room = rsz > TRACE_REPEAT_LEN ? rsz : TRACE_REPEAT_LEN;
+	while ((ti->tb.start + ti->tb.mask + 1) < (ti->tb.end + room)) {
+		const u8 *old;
 
-		hdr = (void *)ti->tb.buf + (ti->tb.start & ti->tb.mask);
-		ti->tb.start += hdr->len_div_8 << 3;
+		old = (void *)ti->tb.buf + (ti->tb.start & ti->tb.mask);
+		ti->tb.start += old[1];
+		ti->tb.lost++;
 	}
 
 	/* Must update ->start before we rewrite new entries. */
 	lwsync(); /* write barrier */
 
 	/* Check for duplicates... */
-	if (!handle_repeat(&ti->tb, trace)) {
+	if (!handle_repeat(ti, trace, rec, rsz)) {
 		/* This may go off end, and that's why ti->tb.buf is oversize */
-		memcpy(ti->tb.buf + (ti->tb.end & ti->tb.mask), trace, tsz);
+		memcpy(ti->tb.buf + (ti->tb.end & ti->tb.mask), rec, rsz);
+		if (rec[2] & TRACE_F_SYNC)
+			ti->next_sync = ti->tb.end + SYNC_INTERVAL;
+		ti->last_tb = trace->hdr.timestamp;
+		ti->last_cpu = trace->hdr.cpu;
 		ti->tb.last = ti->tb.end;
 		lwsync(); /* write barrier: write entry before exposing */
-		ti->tb.end += tsz;
+		ti->tb.end += rsz;
 	}
-	unlock(&ti->lock);
+
+	if (ti->shared)
+		unlock(&ti->lock);
 }
 
 static void trace_add_dt_props(void)
@@ -206,37 +323,33 @@ void init_trace_buffers(void)
 	/* Boot the boot trace in the debug descriptor */
 	trace_add_desc(any, sizeof(boot_tracebuf.buf));
 
-	/* Allocate a trace buffer for each primary cpu. */
+	/*
+	 * Allocate a trace buffer for each thread, so writers never
+	 * contend. This runs before the secondaries are called in, so
+	 * nobody is tracing into the buffers we swap out.
+	 */
 	for_each_cpu(t) {
-		if (t->is_secondary)
-			continue;
-
 		/* Use a 4K alignment for TCE mapping */
 		size = ALIGN_UP(sizeof(*t->trace) + tracebuf_extra(), 0x1000);
 		t->trace = local_alloc(t->chip_id, size, 0x1000);
 		if (t->trace) {
-			any = t->trace;
 			memset(t->trace, 0, size);
 			init_lock(&t->trace->lock);
+			t->trace->tb.version = TRACEBUF_VERSION;
 			t->trace->tb.mask = TBUF_SZ - 1;
 			t->trace->tb.max_size = MAX_SIZE;
-			trace_add_desc(any, sizeof(t->trace->tb) +
+			trace_add_desc(t->trace, sizeof(t->trace->tb) +
 				       tracebuf_extra());
 		} else
 			prerror("TRACE: cpu 0x%x allocation failed\n", t->pir);
 	}
 
-	/* In case any allocations failed, share trace buffers. */
+	/* In case any allocations failed, share the boot buffer. */
 	for_each_cpu(t) {
-		if (!t->is_secondary && !t->trace)
+		if (!t->trace) {
+			any->shared = true;
 			t->trace = any;
-	}
-
-	/* And copy those to the secondaries. */
-	for_each_cpu(t) {
-		if (!t->is_secondary)
-			continue;
-		t->trace = t->primary->trace;
+		}
 	}
 
 	/* Trace node in DT. */
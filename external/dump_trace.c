@@ -14,8 +14,10 @@
  * limitations under the License.
  */
 
+#include <assert.h>
 #include <err.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -29,6 +31,10 @@
 #include "../ccan/short_types/short_types.h"
 #include <trace_types.h>
 
+/* Raw buffer images aren't live, so the reader needs no barriers */
+#define rmb() do { } while (0)
+#include "trace.c"
+
 /* Handles trace from debugfs (one record at a time) or file */ 
 static bool get_trace(int fd, union trace *t, int *len)
 {
@@ -57,7 +63,7 @@ static void display_header(const struct trace_hdr *h)
 	u64 ts = be64_to_cpu(h->timestamp);
 
 	printf("%16lx (+%8lx) [%03x] : ",
-	       ts, prev_ts ? (ts - prev_ts) : 0, h->cpu);
+	       ts, prev_ts ? (ts - prev_ts) : 0, be16_to_cpu(h->cpu));
 	prev_ts = ts;
 }
 
@@ -149,14 +155,106 @@ static void dump_uart(struct trace_uart *t)
 	}
 }
 
+static void display_trace(union trace *t)
+{
+	display_header(&t->hdr);
+	switch (t->hdr.type) {
+	case TRACE_REPEAT:
+		printf("REPEATS: %u times\n",
+		       be16_to_cpu(t->repeat.num));
+		break;
+	case TRACE_OVERFLOW:
+		printf("**OVERFLOW**: %"PRIu64" bytes missed\n",
+		       be64_to_cpu(t->overflow.bytes_missed));
+		break;
+	case TRACE_OPAL:
+		dump_opal_call(&t->opal);
+		break;
+	case TRACE_FSP_MSG:
+		dump_fsp_msg(&t->fsp_msg);
+		break;
+	case TRACE_FSP_EVENT:
+		dump_fsp_event(&t->fsp_evt);
+		break;
+	case TRACE_UART:
+		dump_uart(&t->uart);
+		break;
+	default:
+		printf("UNKNOWN(%u) CPU %u length %u\n",
+		       t->hdr.type, be16_to_cpu(t->hdr.cpu),
+		       t->hdr.len_div_8 * 8);
+	}
+}
+
+/*
+ * A raw image of a trace buffer (struct tracebuf and its contents, eg.
+ * dumped from one of the debug descriptor's trace_phys[] addresses),
+ * which we expand ourselves. It's in the firmware's big endian order.
+ */
+static void dump_raw(int fd, const char *in)
+{
+	struct tracebuf *tb;
+	union trace t;
+	struct stat st;
+
+	if (fstat(fd, &st) < 0)
+		err(1, "Stat %s", in);
+	if (st.st_size < sizeof(*tb))
+		errx(1, "%s: too short for a trace buffer", in);
+
+	tb = malloc(st.st_size);
+	if (!tb)
+		err(1, "Allocating %lu bytes", (unsigned long)st.st_size);
+	if (read(fd, tb, st.st_size) != st.st_size)
+		err(1, "Reading %s", in);
+
+	tb->version = be32_to_cpu(tb->version);
+	if (tb->version != TRACEBUF_VERSION)
+		errx(1, "%s: trace format %u, expected %u", in,
+		     tb->version, TRACEBUF_VERSION);
+	tb->mask = be64_to_cpu(tb->mask);
+	tb->start = be64_to_cpu(tb->start);
+	tb->end = be64_to_cpu(tb->end);
+	tb->max_size = be32_to_cpu(tb->max_size);
+	if (sizeof(*tb) + tb->mask + 1 + tb->max_size > st.st_size)
+		errx(1, "%s: truncated trace buffer", in);
+
+	/* Everything still in there, from the oldest */
+	tb->rpos = tb->start;
+	tb->last_repeat = 0;
+	tb->repeat_seq = 0;
+	tb->rpos_sync = 0;
+
+	while (trace_get(&t, tb)) {
+		/* Payloads come back as written, the header is ours */
+		if (t.hdr.type == TRACE_OVERFLOW) {
+			t.overflow.bytes_missed =
+				cpu_to_be64(t.overflow.bytes_missed);
+		} else {
+			t.hdr.timestamp = cpu_to_be64(t.hdr.timestamp);
+			t.hdr.cpu = cpu_to_be16(t.hdr.cpu);
+			if (t.hdr.type == TRACE_REPEAT)
+				t.repeat.num = cpu_to_be16(t.repeat.num);
+		}
+		display_trace(&t);
+	}
+	free(tb);
+}
+
 int main(int argc, char *argv[])
 {
 	int fd, len = 0;
 	union trace t;
 	const char *in = "/sys/kernel/debug/powerpc/opal-trace";
+	bool raw = false;
 
-	if (argc > 2)
-		errx(1, "Usage: dump_trace [file]");
+	if (argc > 1 && strcmp(argv[1], "-r") == 0) {
+		raw = true;
+		argc--;
+		argv++;
+	}
+	if (argc > 2 || (raw && argc < 2))
+		errx(1, "Usage: dump_trace [file] | dump_trace -r buffer-image");
 
 	if (argv[1])
 		in = argv[1];
@@ -164,34 +262,12 @@ int main(int argc, char *argv[])
 	if (fd < 0)
 		err(1, "Opening %s", in);
 
-	while (get_trace(fd, &t, &len)) {
-		display_header(&t.hdr);
-		switch (t.hdr.type) {
-		case TRACE_REPEAT:
-			printf("REPEATS: %u times\n",
-			       be32_to_cpu(t.repeat.num));
-			break;
-		case TRACE_OVERFLOW:
-			printf("**OVERFLOW**: %"PRIu64" bytes missed\n",
-			       be64_to_cpu(t.overflow.bytes_missed));
-			break;
-		case TRACE_OPAL:
-			dump_opal_call(&t.opal);
-			break;
-		case TRACE_FSP_MSG:
-			dump_fsp_msg(&t.fsp_msg);
-			break;
-		case TRACE_FSP_EVENT:
-			dump_fsp_event(&t.fsp_evt);
-			break;
-		case TRACE_UART:
-			dump_uart(&t.uart);
-			break;
-		default:
-			printf("UNKNOWN(%u) CPU %u length %u\n",
-			       t.hdr.type, be16_to_cpu(t.hdr.cpu),
-			       t.hdr.len_div_8 * 8);
-		}
+	if (raw) {
+		dump_raw(fd, in);
+		return 0;
 	}
+
+	while (get_trace(fd, &t, &len))
+		display_trace(&t);
 	return 0;
 }
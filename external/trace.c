@@ -18,9 +18,30 @@
 #include <trace_types.h>
 #include <errno.h>
 
+static u64 read_varint(const u8 **p)
+{
+	unsigned int shift = 0;
+	u64 val = 0;
+
+	do {
+		val |= (u64)(**p & 0x7f) << shift;
+		shift += 7;
+	} while (*((*p)++) & 0x80);
+	return val;
+}
+
+static u64 read_be(const u8 *p, unsigned int bytes)
+{
+	u64 val = 0;
+
+	while (bytes--)
+		val = (val << 8) | *(p++);
+	return val;
+}
+
 bool trace_empty(const struct tracebuf *tb)
 {
-	const struct trace_repeat *rep;
+	const u8 *rep;
 
 	if (tb->rpos == tb->end)
 		return true;
@@ -31,33 +52,72 @@ bool trace_empty(const struct tracebuf *tb)
 	 * incremented in future), we're also empty.
 	 */
 	rep = (void *)tb->buf + (tb->rpos & tb->mask);
-	if (tb->end != tb->rpos + sizeof(*rep))
+	if (tb->end != tb->rpos + TRACE_REPEAT_LEN)
 		return false;
 
-	if (rep->type != TRACE_REPEAT)
+	if (rep[0] != TRACE_REPEAT)
 		return false;
 
-	if (rep->num != tb->last_repeat)
+	if (read_be(rep + 4, 2) != tb->last_repeat)
 		return false;
 
 	return true;
 }
 
+/* Expand a compact record (see trace_types.h) which we've checked. */
+static void trace_decode(union trace *t, struct tracebuf *tb, const u8 *rec)
+{
+	const u8 *p = rec + 3;
+	u8 *dst = (u8 *)(&t->hdr + 1);
+	unsigned int i, j, words = TRACE_F_WORDS(rec[2]);
+	u64 val;
+	u8 mask;
+
+	val = read_varint(&p);
+	if (rec[2] & TRACE_F_SYNC)
+		tb->rpos_tb = val;
+	else
+		tb->rpos_tb += (val >> 1) ^ -(val & 1);
+	if (rec[2] & TRACE_F_CPU)
+		tb->rpos_cpu = read_varint(&p);
+
+	memset(&t->hdr, 0, sizeof(t->hdr));
+	t->hdr.timestamp = tb->rpos_tb;
+	t->hdr.type = rec[0];
+	t->hdr.len_div_8 = words + sizeof(t->hdr) / 8;
+	t->hdr.cpu = tb->rpos_cpu;
+
+	for (i = 0; i < words; i++) {
+		mask = *(p++);
+		for (j = 0; j < 8; j++)
+			*(dst++) = (mask & (1 << j)) ? *(p++) : 0;
+	}
+}
+
 /* You can't read in parallel, so some locking required in caller. */
 bool trace_get(union trace *t, struct tracebuf *tb)
 {
-	u64 start;
-	size_t len = sizeof(*t) < tb->max_size ? sizeof(*t) : tb->max_size;
+	u8 rec[256];
+	u64 start, seq, missed = 0;
+	size_t len = sizeof(rec) < tb->max_size ? sizeof(rec) : tb->max_size;
+	unsigned int rlen;
 
 	if (trace_empty(tb))
 		return false;
 
 again:
+	/* Only once we skipped everything there was while resyncing. */
+	if (tb->rpos == tb->end)
+		goto overflow;
+
+	seq = tb->repeat_seq;
+	rmb(); /* read barrier, so we read end and repeat_seq first. */
+
 	/*
 	 * The actual buffer is slightly larger than tbsize, so this
 	 * memcpy is always valid.
 	 */
-	memcpy(t, tb->buf + (tb->rpos & tb->mask), len);
+	memcpy(rec, tb->buf + (tb->rpos & tb->mask), len);
 
 	rmb(); /* read barrier, so we read tb->start after copying record. */
 
@@ -65,21 +125,45 @@ again:
 
 	/* Now, was that overwritten? */
 	if (tb->rpos < start) {
-		/* Create overflow record. */
-		t->overflow.unused64 = 0;
-		t->overflow.type = TRACE_OVERFLOW;
-		t->overflow.len_div_8 = sizeof(t->overflow) / 8;
-		t->overflow.bytes_missed = start - tb->rpos;
-		tb->rpos += t->overflow.bytes_missed;
-		return true;
+		missed += start - tb->rpos;
+		tb->rpos = start;
+		tb->rpos_sync = 0;
+		tb->last_repeat = 0;
+		goto again;
+	}
+
+	rlen = rec[1];
+	assert(rlen >= 3 && rlen <= len);
+
+	/* Timestamps are deltas, so we need an absolute one to go on. */
+	if (!tb->rpos_sync && !(rec[2] & TRACE_F_SYNC)) {
+		missed += rlen;
+		tb->rpos += rlen;
+		tb->last_repeat = 0;
+		goto again;
 	}
 
+	/* Report what we skipped first, the next call gets this one. */
+	if (missed)
+		goto overflow;
+
 	/* Repeat entries need special handling */
-	if (t->hdr.type == TRACE_REPEAT) {
-		u32 num = t->repeat.num;
+	if (rec[0] == TRACE_REPEAT) {
+		u32 num;
+
+		/* The writer updated it while we copied: try again. */
+		if ((seq & 1) || tb->repeat_seq != seq)
+			goto again;
+
+		num = read_be(rec + 4, 2);
+		t->repeat.timestamp = read_be(rec + 6, 8);
+		t->repeat.type = TRACE_REPEAT;
+		t->repeat.len_div_8 = sizeof(t->repeat) / 8;
+		t->repeat.cpu = tb->rpos_cpu;
+		t->repeat.prev_len = rec[3] * 8;
 
 		/* In case we've read some already... */
-		t->repeat.num -= tb->last_repeat;
+		t->repeat.num = num - tb->last_repeat;
 
 		/* Record how many repeats we saw this time. */
 		tb->last_repeat = num;
@@ -90,16 +174,27 @@ again:
 			 * This can't be the last buffer, otherwise
 			 * trace_empty would have returned true.
 			 */
-			assert(tb->end > tb->rpos + t->hdr.len_div_8 * 8);
+			assert(tb->end > tb->rpos + rlen);
 			/* Skip to next entry. */
-			tb->rpos += t->hdr.len_div_8 * 8;
+			tb->rpos += rlen;
 			tb->last_repeat = 0;
 			goto again;
 		}
 	} else {
+		trace_decode(t, tb, rec);
+		tb->rpos_sync = 1;
 		tb->last_repeat = 0;
-		tb->rpos += t->hdr.len_div_8 * 8;
+		tb->rpos += rlen;
 	}
 
 	return true;
+
+overflow:
+	/* Create overflow record. */
+	t->overflow.unused64 = 0;
+	t->overflow.type = TRACE_OVERFLOW;
+	t->overflow.len_div_8 = sizeof(t->overflow) / 8;
+	memset(t->overflow.unused, 0, sizeof(t->overflow.unused));
+	t->overflow.bytes_missed = missed;
+	return true;
 }
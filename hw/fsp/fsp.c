@@ -217,9 +217,11 @@ static struct fsp_cmdclass *fsp_get_cmdclass(struct fsp_msg *msg)
 	return __fsp_get_cmdclass(c);
 }
 
+static DEFINE_SLAB_CACHE(fsp_msg_cache, struct fsp_msg);
+
 static struct fsp_msg *__fsp_allocmsg(void)
 {
-	return zalloc(sizeof(struct fsp_msg));
+	return slab_zalloc(&fsp_msg_cache);
 }
 
 struct fsp_msg *fsp_allocmsg(bool alloc_response)
@@ -236,7 +238,7 @@ struct fsp_msg *fsp_allocmsg(bool alloc_response)
 
 void __fsp_freemsg(struct fsp_msg *msg)
 {
-	free(msg);
+	slab_free(&fsp_msg_cache, msg);
 }
 
 void fsp_freemsg(struct fsp_msg *msg)
@@ -1875,6 +1877,7 @@ void fsp_init(void)
 {
 	printf("FSP: Looking for FSP...\n");
 
+	lock_set_name(&fsp_lock, "fsp");
 	fsp_init_tce_table();
 
 	if (!fsp_init_one("ibm,fsp1") && !fsp_init_one("ibm,fsp2")) {
@@ -45,6 +45,7 @@
 #include <phb3-regs.h>
 #include <capp.h>
 #include <fsp.h>
+#include <boot-timeline.h>
 
 /* Enable this to disable error interrupts for debug purposes */
 #undef DISABLE_ERR_INTS
@@ -3552,7 +3553,9 @@ static void phb3_create(struct dt_node *np)
 	struct phb3 *p = zalloc(sizeof(struct phb3));
 	size_t lane_eq_len;
 	struct dt_node *iplp;
+	char name[LOCK_NAME_LEN];
 	char *path;
+	int ev;
 
 	assert(p);
 
@@ -3610,6 +3613,8 @@ static void phb3_create(struct dt_node *np)
 	 * get a useful OPAL ID for it
 	 */
 	pci_register_phb(&p->phb);
+	snprintf(name, sizeof(name), "phb3-%d", p->phb.opal_id);
+	lock_set_name(&p->lock, name);
 
 	/* Hello ! */
 	path = dt_get_path(np);
@@ -3672,7 +3677,9 @@ static void phb3_create(struct dt_node *np)
 			    p->base_lsi + PHB3_LSI_PCIE_INF, 2);
 #endif
 	/* Get the HW up and running */
+	ev = boot_timeline_start("phb3-init", p->phb.opal_id);
 	phb3_init_hw(p);
+	boot_timeline_end(ev);
 
 	/* Load capp microcode into capp unit if PHB0 */
 	if (p->index == 0)
@@ -862,14 +862,16 @@ static void slw_init_chip(struct proc_chip *chip)
 	}
 }
 
-void slw_init(void)
+static void slw_init_one_chip(unsigned int chip_id, void *data __unused)
 {
-	struct proc_chip *chip;
+	slw_init_chip(get_chip(chip_id));
+}
 
+void slw_init(void)
+{
 	if (proc_gen != proc_gen_p8)
 		return;
 
-	for_each_chip(chip)
-		slw_init_chip(chip);
+	cpu_parallel_for_chips(slw_init_one_chip, NULL);
 }
 
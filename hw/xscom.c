@@ -479,6 +479,8 @@ void xscom_init(void)
 {
 	struct dt_node *xn;
 
+	lock_set_name(&xscom_lock, "xscom");
+
 	dt_for_each_compatible(dt_root, xn, "ibm,xscom") {
 		uint32_t gcid = dt_get_chip_id(xn);
 		const struct dt_property *reg;
@@ -0,0 +1,79 @@
+/* Copyright 2013-2014 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BOOT_TIMELINE_H
+#define __BOOT_TIMELINE_H
+
+#include <stdint.h>
+#include <ccan/short_types/short_types.h>
+
+/*
+ * Boot timeline
+ *
+ * Start and end timebase values of the boot phases, for the OS and
+ * for tools to trend firmware boot time. The table is found through
+ * the "ibm,opal-boot-timeline" property of /ibm,opal (address and
+ * size), it's in big endian like the rest of skiboot.
+ *
+ * Timestamps are on the synchronized timebase. Those taken before
+ * the ChipTOD sync are moved onto it, so they wrap to "negative"
+ * values when the timebase got reset to a smaller one. Differences
+ * are always right in unsigned 64-bit arithmetic.
+ */
+#define BOOT_TIMELINE_VERSION	1
+#define BOOT_TIMELINE_ENTRIES	256
+#define BOOT_EVENT_NAME_LEN	16
+#define BOOT_EVENT_NO_ID	0xffffffff
+
+struct boot_event {
+	u64	start_tb;
+	u64	end_tb;			/* 0 while still running */
+	u32	id;			/* PHB, chip... or BOOT_EVENT_NO_ID */
+	u32	pir;			/* Thread which ran it */
+	char	name[BOOT_EVENT_NAME_LEN];
+};
+
+struct boot_timeline {
+	char	eye_catcher[8];		/* "BOOTTIME" */
+	u32	version;
+	u32	entry_size;
+	u32	max_entries;
+	u32	num_entries;
+	u64	tb_hz;
+	struct boot_event events[BOOT_TIMELINE_ENTRIES];
+};
+
+/*
+ * Returns a handle for boot_timeline_end(), negative if the table
+ * is full, which boot_timeline_end() ignores.
+ */
+extern int boot_timeline_start(const char *name, u32 id);
+extern void boot_timeline_end(int ev);
+
+/* End the previous phase and start the next, for sequences of steps */
+static inline int boot_timeline_next(int prev, const char *name)
+{
+	boot_timeline_end(prev);
+	return boot_timeline_start(name, BOOT_EVENT_NO_ID);
+}
+
+/* Move what was recorded so far across a timebase change */
+extern void boot_timeline_tb_sync(u64 old_tb, u64 new_tb);
+
+extern void boot_timeline_add_properties(void);
+extern void boot_timeline_print(void);
+
+#endif /* __BOOT_TIMELINE_H */
@@ -39,6 +39,9 @@
 /* Enable lock debugging */
 #define DEBUG_LOCKS		1
 
+/* Enable contention and hold time accounting for named locks */
+//#define LOCK_STATS		1
+
 /* Enable malloc debugging */
 #define DEBUG_MALLOC		1
 
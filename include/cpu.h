@@ -22,6 +22,7 @@
 #include <lock.h>
 #include <device.h>
 #include <opal.h>
+#include <slab.h>
 
 /*
  * cpu_thread is our internal structure representing each
@@ -41,6 +42,9 @@ enum cpu_thread_state {
 
 struct cpu_job;
 
+/* Jobs that can be queued on a CPU before producers have to wait */
+#define CPU_JOB_RING_SIZE	16
+
 struct cpu_thread {
 	uint32_t			pir;
 	uint32_t			server_no;
@@ -58,8 +62,18 @@ struct cpu_thread {
 	bool				con_need_flush;
 	uint32_t			hbrt_spec_wakeup; /* primary only */
 
-	struct lock			job_lock;
-	struct list_head		job_queue;
+	/* Queue nodes for the locks we hold or wait on, see lock.h */
+	struct lock_qnode		lock_nodes[LOCK_MAX_NESTING];
+
+	/*
+	 * Bounded MPSC ring of queued jobs. Producers reserve a slot by
+	 * bumping job_head and then fill it in; only this CPU consumes.
+	 */
+	struct cpu_job			*job_ring[CPU_JOB_RING_SIZE];
+	unsigned long			job_head;
+	unsigned long			job_tail;
+
+	struct slab_magazine		*slab_mags[SLAB_MAX_CACHES];
 };
 
 /* This global is set to 1 to allow secondaries to callin,
@@ -168,7 +182,7 @@ static inline bool cpu_is_sibling(struct cpu_thread *cpu1,
 /* Called when some error condition requires disabling a core */
 void cpu_disable_all_threads(struct cpu_thread *cpu);
 
-/* Allocate & queue a job on target CPU */
+/* Allocate & queue a job on target CPU, waiting for room if need be */
 extern struct cpu_job *__cpu_queue_job(struct cpu_thread *cpu,
 				       void (*func)(void *data), void *data,
 				       bool no_return);
@@ -193,9 +207,65 @@ extern void cpu_wait_job(struct cpu_job *job, bool free_it);
 /* Free a CPU job, only call on a completed job */
 extern void cpu_free_job(struct cpu_job *job);
 
+/*
+ * Job groups, to wait for a fan-out in one go. Jobs are added with
+ * cpu_job_group_queue(). Timeouts are in timebase ticks, 0 means
+ * forever. Once done waiting, cpu_poll_job() tells which jobs
+ * completed, and cpu_job_group_release() frees them all. Jobs still
+ * running are abandoned and freed when they eventually finish, so
+ * their data must outlive the caller.
+ */
+struct cpu_job_group {
+	struct cpu_job		*first;
+	unsigned int		count;
+};
+
+extern void cpu_job_group_init(struct cpu_job_group *group);
+extern struct cpu_job *cpu_job_group_queue(struct cpu_job_group *group,
+					   struct cpu_thread *cpu,
+					   void (*func)(void *data),
+					   void *data);
+extern struct cpu_thread *cpu_job_cpu(struct cpu_job *job);
+
+/* Returns the number of jobs which haven't completed */
+extern unsigned int cpu_job_group_wait_all(struct cpu_job_group *group,
+					   unsigned long timeout);
+
+/* Returns a job which completed since the last call, or NULL if none
+ * did before the timeout or all have been returned already.
+ */
+extern struct cpu_job *cpu_job_group_wait_any(struct cpu_job_group *group,
+					      unsigned long timeout);
+
+extern void cpu_job_group_release(struct cpu_job_group *group);
+
 /* Called by init to process jobs */
 extern void cpu_process_jobs(void);
 
+/*
+ * Run func(i, data) for every i in [start, end), spread over the caller
+ * and the secondaries idling in the job loop, and return when all are
+ * done.
+ */
+extern void cpu_parallel_for(unsigned int start, unsigned int end,
+			     void (*func)(unsigned int i, void *data),
+			     void *data);
+
+/*
+ * Run func(chip_id, data) once for each chip, on a secondary of that
+ * chip when there is one and on the caller otherwise, and return when
+ * all are done.
+ */
+extern void cpu_parallel_for_chips(void (*func)(unsigned int chip_id,
+						void *data),
+				   void *data);
+
+/* Wait for jobs at low priority. Returns when some are queued. */
+extern void cpu_idle(void);
+
+/* Measure and print how long it takes a job to start on each CPU */
+extern void cpu_job_latency_test(void);
+
 static inline void cpu_give_self_os(void)
 {
 	__this_cpu->state = cpu_state_os;
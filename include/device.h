@@ -32,11 +32,14 @@
  */
 struct dt_property {
 	struct list_node list;
-	const char *name;
+	const char *name;	/* Interned, see dt_find_name() */
 	size_t len;
-	char prop[/* len */];
+	char *prop;		/* data[], or the FDT we were expanded from */
+	char data[/* len */];
 };
 
+struct dt_prop_index;
+
 struct dt_node {
 	const char *name;
 	struct list_node list;
@@ -44,8 +47,17 @@ struct dt_node {
 	struct list_head children;
 	struct dt_node *parent;
 	u32 phandle;
+	u32 num_props;
+	/* Hash of the properties, built past DT_PROP_INDEX_MIN of them */
+	struct dt_prop_index *prop_index;
+	/* Next node in the same phandle hash bucket */
+	struct dt_node *phandle_next;
+	/* Siblings are in increasing order of this */
+	u32 seq;
 };
 
+#define DT_PROP_INDEX_MIN	8
+
 /* This is shared with device_tree.c .. make it static when
  * the latter is gone (hopefully soon)
  */
@@ -54,6 +66,15 @@ extern u32 last_phandle;
 extern struct dt_node *dt_root;
 extern struct dt_node *dt_chosen;
 
+/*
+ * Bulk build mode: nodes, properties and names created between these
+ * are carved out of large chunks and only given back to the heap once
+ * all of them have been freed. Calls may nest. Like every other tree
+ * mutation, boot CPU only: nothing here is locked.
+ */
+void dt_arena_begin(void);
+void dt_arena_end(void);
+
 /* Create a root node: ie. a parentless one. */
 struct dt_node *dt_new_root(const char *name);
 
@@ -139,7 +160,11 @@ bool dt_prop_find_string(const struct dt_property *p, const char *s);
 /* Check a compatible property */
 bool dt_node_is_compatible(const struct dt_node *node, const char *compat);
 
-/* Find a node based on compatible property */
+/*
+ * Find a node based on compatible property. Nodes are indexed on each
+ * of their compatible strings, so this only visits matching nodes. The
+ * compatible property must not be modified in place once added.
+ */
 struct dt_node *dt_find_compatible_node(struct dt_node *root,
 					struct dt_node *prev,
 					const char *compat);
@@ -169,6 +194,13 @@ struct dt_node *dt_find_by_path(struct dt_node *root, const char *path);
 /* Find a node by phandle */
 struct dt_node *dt_find_by_phandle(struct dt_node *root, u32 phandle);
 
+/*
+ * Property names are interned: all properties with the same name share
+ * one copy of it, so they can be compared by pointer. Returns the
+ * interned copy of name, or NULL if no property was ever called that.
+ */
+const char *dt_find_name(const char *name);
+
 /* Find a property by name. */
 const struct dt_property *dt_find_property(const struct dt_node *node,\
 					   const char *name);
@@ -188,6 +220,7 @@ void dt_free(struct dt_node *node);
 /* Parse an initial fdt */
 void dt_expand(const void *fdt);
 int dt_expand_node(struct dt_node *node, const void *fdt, int fdt_node);
+int dt_expand_node_ref(struct dt_node *node, void *fdt, int fdt_node);
 
 /* Simplified accessors */
 u64 dt_prop_get_u64(const struct dt_node *node, const char *prop);
@@ -18,13 +18,61 @@
 #define __LOCK_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Locks are MCS queue locks: each waiter spins on its own node, which
+ * lives in its cpu_thread, and the owner hands the lock over to the
+ * next waiter in the order they arrived.
+ */
+struct lock_qnode {
+	struct lock_qnode	*next;
+	bool			wait;
+	bool			in_use;
+};
+
+/* How many locks a CPU can hold or wait on at once */
+#define LOCK_MAX_NESTING	8
+
+/*
+ * Contention accounting for locks given a name with lock_set_name().
+ * Counters are updated by the lock owner, times are in timebase ticks
+ * and spin times only count contended acquisitions. The table is
+ * published in the debug descriptor.
+ */
+#define LOCK_NAME_LEN		24
+#define LOCK_STATS_ENTRIES	128
+
+struct lock_stat {
+	char		name[LOCK_NAME_LEN];
+	uint64_t	acquires;
+	uint64_t	contended;
+	uint64_t	spin_total;
+	uint64_t	spin_max;
+	uint64_t	hold_max;
+};
+
+struct lock_stats {
+	uint32_t		num_entries;
+	uint32_t		max_entries;
+	struct lock_stat	entries[LOCK_STATS_ENTRIES];
+};
 
 struct lock {
-	/* Lock value has bit 63 as lock bit and the PIR of the owner
-	 * in the top 32-bit
+	/* Lock value has bit 0 as lock bit and the PIR of the owner
+	 * in the top 32-bit. It is only written by the owner.
 	 */
 	unsigned long lock_val;
 
+	/* The last queued waiter (or the owner), and the owner's node */
+	struct lock_qnode *tail;
+	struct lock_qnode *owner;
+
+	/* Set by lock_set_name(), and when the owner got the lock */
+	struct lock_stat *stats;
+	unsigned long hold_start;
+
 	/*
 	 * Set to true if lock is involved in the console flush path
 	 * in which case taking it will suspend console flushing
@@ -33,7 +81,8 @@ struct lock {
 };
 
 /* Initializer */
-#define LOCK_UNLOCKED	{ .lock_val = 0, .in_con_path = 0 }
+#define LOCK_UNLOCKED	{ .lock_val = 0, .tail = NULL, .owner = NULL, \
+			  .stats = NULL, .in_con_path = 0 }
 
 /* Note vs. libc and locking:
  *
@@ -54,6 +103,11 @@ struct lock {
  *
  * lock() is a full memory barrier. unlock() is a lwsync
  *
+ * Note about fairness:
+ *
+ * Waiters get the lock in the order they called lock(). try_lock()
+ * only succeeds if nobody holds or waits for the lock.
+ *
  */
 
 extern bool bust_locks;
@@ -61,10 +115,21 @@ extern bool bust_locks;
 static inline void init_lock(struct lock *l)
 {
 	l->lock_val = 0;
+	l->tail = NULL;
+	l->owner = NULL;
+	l->stats = NULL;
 	l->in_con_path = false;
 }
 
-extern bool __try_lock(struct lock *l);
+/*
+ * Give a lock a name and start accounting for it. The name is copied.
+ * The caller must not be holding the lock.
+ */
+extern void lock_set_name(struct lock *l, const char *name);
+
+extern unsigned long __lock_xchg(unsigned long *mem, unsigned long val);
+extern unsigned long __lock_cmpxchg(unsigned long *mem, unsigned long old,
+				    unsigned long new);
 extern bool try_lock(struct lock *l);
 extern void lock(struct lock *l);
 extern void unlock(struct lock *l);
@@ -77,6 +142,38 @@ extern void unlock(struct lock *l);
  */
 extern bool lock_recursive(struct lock *l);
 
+/*
+ * Reader-writer locks, for tables which are read on every OPAL call
+ * and almost never change. Any number of readers can hold the lock;
+ * a writer waits for them to drain and keeps new readers out while
+ * it does, so writers aren't starved. Writers queue on wlock.
+ *
+ * read_lock() is an acquire barrier (isync), write_lock() is a full
+ * memory barrier and both unlocks are a lwsync. Neither side nests:
+ * a reader which tries to take the lock again can deadlock against
+ * a waiting writer.
+ */
+struct rwlock {
+	/* Number of readers, plus RWLOCK_WRITER while a writer is in */
+	unsigned long val;
+	struct lock wlock;
+};
+
+#define RWLOCK_WRITER	(1ul << 63)
+
+#define RWLOCK_UNLOCKED	{ .val = 0, .wlock = LOCK_UNLOCKED }
+
+static inline void init_rwlock(struct rwlock *rw)
+{
+	rw->val = 0;
+	init_lock(&rw->wlock);
+}
+
+extern void read_lock(struct rwlock *rw);
+extern void read_unlock(struct rwlock *rw);
+extern void write_lock(struct rwlock *rw);
+extern void write_unlock(struct rwlock *rw);
+
 /* Called after per-cpu data structures are available */
 extern void init_locks(void);
 
@@ -64,6 +64,12 @@
 #define HEAP_BASE		(SKIBOOT_BASE + 0x00200000)
 #define HEAP_SIZE		0x00c00000
 
+/* In addition, each chip gets a heap of this size carved out of its
+ * own memory (see mem_region.c), which malloc() prefers when called
+ * from a CPU on that chip.
+ */
+#define CHIP_HEAP_SIZE		0x00200000
+
 /* This is our PSI TCE table. It's 16K entries on P7 and 256K
  * entries on P8
  */
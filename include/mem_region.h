@@ -33,6 +33,41 @@ enum mem_region_type {
 	REGION_OS,
 };
 
+/*
+ * Per-callsite heap accounting, keyed by the location string recorded
+ * in each allocation. There is one table for skiboot_heap and the memory
+ * node regions (all under mem_region_lock) plus one per chip heap, each
+ * updated under its heap's lock and published in the debug descriptor.
+ *
+ * Byte counts include the allocation header.
+ */
+#define HEAP_STATS_ENTRIES	256
+#define HEAP_STATS_BUCKETS	32
+
+struct heap_stat {
+	uint64_t location;	/* Address of location string, 0 if unused */
+	uint64_t cur_bytes;
+	uint64_t peak_bytes;
+	uint64_t allocs;
+	uint64_t frees;
+};
+
+struct heap_stats {
+	uint32_t num_entries;
+	uint32_t num_buckets;
+	/* Number of allocations of [2^n, 2^(n+1)) bytes requested */
+	uint64_t histogram[HEAP_STATS_BUCKETS];
+	/* Anything which didn't fit in the table */
+	struct heap_stat overflow;
+	struct heap_stat entries[HEAP_STATS_ENTRIES];
+};
+
+/*
+ * Free blocks are kept on segregated lists, one per power-of-two size
+ * class (in longs). The last list also catches everything bigger.
+ */
+#define MEM_REGION_FREE_BINS	32
+
 /* An area of physical memory. */
 struct mem_region {
 	struct list_node list;
@@ -40,7 +75,11 @@ struct mem_region {
 	uint64_t start, len;
 	struct dt_node *mem_node;
 	enum mem_region_type type;
-	struct list_head free_list;
+	struct list_head free_list[MEM_REGION_FREE_BINS];
+	/* Bit n set if free_list[n] is non-empty */
+	unsigned long free_list_map;
+	/* Accounting table, NULL if not allocatable */
+	struct heap_stats *stats;
 };
 
 extern struct lock mem_region_lock;
@@ -59,11 +98,28 @@ extern struct mem_region skiboot_heap;
 
 void mem_region_init(void);
 
+/* Allocate from the caller's chip heap, falling back to the others
+ * and finally skiboot_heap. These take the appropriate heap lock.
+ */
+void *mem_heap_alloc(size_t size, size_t align, const char *location);
+void mem_heap_free(void *mem, const char *location);
+bool mem_heap_resize(void *mem, size_t len, const char *location);
+size_t mem_heap_size(const void *mem);
+
+/* The same for n objects of one size at a time, under one lock per heap.
+ * Allocation is from the local chip heap, then skiboot_heap, and
+ * returns how many it got.
+ */
+unsigned int mem_heap_alloc_batch(size_t size, size_t align, void **objs,
+				  unsigned int n, const char *location);
+void mem_heap_free_batch(void **objs, unsigned int n, const char *location);
+
 void mem_region_add_dt_reserved(void);
 
 /* Mark memory as reserved */
 void mem_reserve(const char *name, uint64_t start, uint64_t len);
 
 struct mem_region *find_mem_region(const char *name);
+struct mem_region *mem_region_next(struct mem_region *region);
 
 #endif /* __MEMORY_REGION */
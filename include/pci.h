@@ -486,6 +486,7 @@ extern struct pci_device *pci_walk_dev(struct phb *phb,
 extern struct pci_device *pci_find_dev(struct phb *phb, uint16_t bdfn);
 
 /* Manage PHBs */
+extern struct lock pci_lock;
 extern int64_t pci_register_phb(struct phb *phb);
 extern int64_t pci_unregister_phb(struct phb *phb);
 extern struct phb *pci_get_phb(uint64_t phb_id);
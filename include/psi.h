@@ -142,6 +142,7 @@
  *   - 4x256K serial areas (each divided in 2: in and out buffers)
  *   - 1M region for inbound buffers
  *   - 2M region for generic data fetches
+ *   - 8M region for fetching the kernel in the background
  */
 #define PSI_DMA_SER0_BASE		0x00000000
 #define PSI_DMA_SER0_SIZE		0x00040000
@@ -193,6 +194,8 @@
 #define PSI_DMA_MEMCONS_SZ		0x00001000
 #define PSI_DMA_LOG_BUF			0x03200000
 #define PSI_DMA_LOG_BUF_SZ		0x00100000 /* INMEM_CON_LEN */
+#define PSI_DMA_KERNEL_FETCH		0x03300000
+#define PSI_DMA_KERNEL_FETCH_SZ		0x00800000
 
 /* P8 only mappings */
 #define PSI_DMA_TRACE_BASE		0x04000000
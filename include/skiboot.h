@@ -37,6 +37,7 @@
 #include <ccan/str/str.h>
 
 #include <mem-map.h>
+#include <chip.h>
 #include <op-panel.h>
 #include <platform.h>
 
@@ -56,7 +57,7 @@ static inline bool is_rodata(const void *p)
  */
 struct debug_descriptor {
 	u8	eye_catcher[8];	/* "OPALdbug" */
-#define DEBUG_DESC_VERSION	1
+#define DEBUG_DESC_VERSION	5
 	u32	version;
 	u32	reserved[3];
 
@@ -66,13 +67,23 @@ struct debug_descriptor {
 	u32	memcons_obuf_tce;
 	u32	memcons_ibuf_tce;
 
-	/* Traces */
+	/* Traces, one per thread since version 4. Since version 5 the
+	 * records are compact, and struct tracebuf starts with a version.
+	 */
 	u64	trace_mask;
 	u32	num_traces;
-#define DEBUG_DESC_MAX_TRACES	256
+#define DEBUG_DESC_MAX_TRACES	2048
 	u64	trace_phys[DEBUG_DESC_MAX_TRACES];
 	u32	trace_size[DEBUG_DESC_MAX_TRACES];
 	u32	trace_tce[DEBUG_DESC_MAX_TRACES];
+
+	/* Heap accounting tables (struct heap_stats), since version 2 */
+	u32	num_heap_stats;
+#define DEBUG_DESC_MAX_HEAP_STATS	(MAX_CHIPS + 1)	/* skiboot_heap + 1 per chip */
+	u64	heap_stats_phys[DEBUG_DESC_MAX_HEAP_STATS];
+
+	/* Lock accounting table (struct lock_stats), since version 3 */
+	u64	lock_stats_phys;
 };
 extern struct debug_descriptor debug_descriptor;
 
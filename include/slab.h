@@ -0,0 +1,69 @@
+/* Copyright 2013-2014 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SLAB_H
+#define __SLAB_H
+
+#include <stddef.h>
+#include <mem_region-malloc.h>
+
+/*
+ * Object caches for hot, fixed-size structures.
+ *
+ * Each CPU keeps a small magazine of free objects per cache, so most
+ * allocations and frees never touch a heap lock. An empty magazine is
+ * refilled from the CPU's chip heap, and a full one partially drained,
+ * in a batch under a single acquisition of the heap lock. Secondaries
+ * drain their magazines whenever they go idle.
+ *
+ * A cache may only be used from skiboot context (not from exception
+ * handlers), since the per-CPU magazines are not otherwise protected.
+ */
+
+/* Max number of caches, each has a magazine pointer in cpu_thread */
+#define SLAB_MAX_CACHES		8
+
+/* Number of objects held by a per-CPU magazine */
+#define SLAB_MAG_SIZE		16
+
+struct slab_cache {
+	const char	*name;
+	size_t		size;
+	const char	*location;
+	/* Index into the per-CPU magazines, assigned on first use */
+	int		index;
+};
+
+#define DEFINE_SLAB_CACHE(_cache, _type)		\
+	struct slab_cache _cache = {			\
+		.name		= #_type,		\
+		.size		= sizeof(_type),	\
+		.location	= __location__,		\
+		.index		= -1,			\
+	}
+
+void *slab_alloc(struct slab_cache *cache);
+void *slab_zalloc(struct slab_cache *cache);
+void slab_free(struct slab_cache *cache, void *obj);
+
+/*
+ * Give everything in this CPU's magazines back to the heap, so objects
+ * a CPU won't use any time soon don't stay charged to their allocation
+ * site in the heap stats.
+ */
+void slab_drain(void);
+
+#endif /* __SLAB_H */
@@ -77,6 +77,11 @@ static inline unsigned long tb_to_usecs(unsigned long tb)
 	return (tb * 1000000) / tb_hz;
 }
 
+static inline unsigned long tb_to_nsecs(unsigned long tb)
+{
+	return (tb * 1000000000) / tb_hz;
+}
+
 extern unsigned long timespec_to_tb(const struct timespec *ts);
 
 /* wait_poll - Wait a certain number of TB ticks while polling FSP */
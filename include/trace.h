@@ -21,7 +21,8 @@
 #include <lock.h>
 #include <trace_types.h>
 
-#define TBUF_SZ (1024 * 1024)
+/* Per thread, ie. 1MB for a P8 core */
+#define TBUF_SZ (128 * 1024)
 
 struct cpu_thread;
 
@@ -29,8 +30,13 @@ struct cpu_thread;
 void init_boot_tracebuf(struct cpu_thread *boot_cpu);
 
 struct trace_info {
-	/* Lock for writers. */
+	/* Lock for writers, only used if the buffer is shared. */
 	struct lock lock;
+	bool shared;
+	/* Writer's encoding state: see trace_types.h */
+	u64 last_tb;
+	u64 next_sync;
+	u16 last_cpu;
 	/* Exposed to kernel. */
 	struct tracebuf tb;
 };
@@ -24,8 +24,14 @@
 #define TRACE_FSP_EVENT	5	/* FSP driver event */
 #define TRACE_UART	6	/* UART driver traces */
 
-/* One per cpu, plus one for NMIs */
+/* Format of the records below, bumped on any incompatible change */
+#define TRACEBUF_VERSION	1
+
+/* One per thread, plus one for early boot */
 struct tracebuf {
+	/* TRACEBUF_VERSION. Stays first so any reader can check it. */
+	u32 version;
+	u32 reserved;
 	/* Mask to apply to get buffer offset. */
 	u64 mask;
 	/* This where the buffer starts. */
@@ -40,10 +46,51 @@ struct tracebuf {
 	u32 last_repeat;
 	/* Maximum possible size of a record. */
 	u32 max_size;
+	/* Records the writer has thrown away to make room. */
+	u64 lost;
+	/* Odd while the writer updates the last repeat record in place. */
+	u64 repeat_seq;
+	/* Timestamp and cpu of the last full record the reader decoded. */
+	u64 rpos_tb;
+	u32 rpos_cpu;
+	/* Zero until the reader has seen a TRACE_F_SYNC record. */
+	u32 rpos_sync;
 
 	char buf[/* TBUF_SZ + max_size */];
 };
 
+/*
+ * Records are stored compactly, and trace_get() expands them back into
+ * a union trace. Each record starts with three bytes:
+ *
+ *	type, length of the whole record, flags
+ *
+ * The top nibble of flags is the number of 8-byte words following the
+ * header in the union trace. Then come:
+ *
+ *  - the timestamp as a varint (7 bits per byte, low bits first): the
+ *    zigzag encoded delta from the previous full record, or absolute
+ *    with TRACE_F_SYNC.
+ *  - the cpu as a varint, with TRACE_F_CPU only.
+ *  - each payload word as a byte with bit n set if byte n of the word
+ *    is non-zero, followed by those bytes. Zero bytes (unused arguments,
+ *    the top of small values) take no space.
+ *
+ * A reader who lost track, ie. after an overflow, must skip ahead to
+ * the next TRACE_F_SYNC record; those always carry the cpu too.
+ */
+#define TRACE_F_SYNC		0x01	/* Absolute timestamp */
+#define TRACE_F_CPU		0x02	/* cpu differs from previous record */
+#define TRACE_F_WORDS(flags)	((flags) >> 4)
+
+/*
+ * Repeat records are fixed size, so the writer can update them in place:
+ *
+ *	TRACE_REPEAT, TRACE_REPEAT_LEN, 0, prev_len / 8,
+ *	num (16 bits), timestamp (64 bits), both big endian.
+ */
+#define TRACE_REPEAT_LEN	14
+
 /* Common header for all trace entries. */
 struct trace_hdr {
 	u64 timestamp;
@@ -61,7 +108,10 @@ struct trace_repeat {
 	u16 cpu;
 	u16 prev_len;
 	u16 num; /* Starts at 1, ie. 1 repeat, or two traces. */
-	/* Note that the count can be one short, if read races a repeat. */
+	/*
+	 * num and timestamp are updated in place: re-read the record if
+	 * tracebuf.repeat_seq was odd or changed while copying it.
+	 */
 };
 
 /* Overflow is special */
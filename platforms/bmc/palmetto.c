@@ -22,6 +22,7 @@
 #include <chip.h>
 #include <xscom.h>
 #include <ast.h>
+#include <boot-timeline.h>
 
 #include "bmc.h"
 
@@ -38,15 +39,20 @@ static void palmetto_ext_irq(unsigned int chip_id __unused)
 
 static void palmetto_init(void)
 {
+	int ph;
+
 	/* Setup dummy console nodes */
 	if (dummy_console_enabled())
 		dummy_console_add_nodes();
 
 	/* Initialize AHB accesses via AST2400 */
+	ph = boot_timeline_start("ast-io", BOOT_EVENT_NO_ID);
 	ast_io_init();
 
 	/* Initialize PNOR/NVRAM */
+	ph = boot_timeline_next(ph, "pnor");
 	pnor_init();
+	boot_timeline_end(ph);
 }
 
 
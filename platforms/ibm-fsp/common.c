@@ -20,6 +20,7 @@
 #include <fsp-sysparam.h>
 #include <opal.h>
 #include <console.h>
+#include <boot-timeline.h>
 
 #include "ibm-fsp.h"
 
@@ -48,9 +49,9 @@ static void map_debug_areas(void)
 	t = PSI_DMA_TRACE_BASE;
 	for (i = 0; i < debug_descriptor.num_traces; i++) {
 		/*
-		 * Trace buffers are misaligned by 0x10 due to the lock
-		 * in the trace structure, and their size is also not
-		 * completely aligned. (They are allocated so that with
+		 * Trace buffers are misaligned due to the writer state
+		 * (lock etc.) in the trace structure, and their size is
+		 * also not completely aligned. (They are allocated so that with
 		 * the lock included, they do cover entire multiple of
 		 * a 4K page however).
 		 *
@@ -77,7 +78,10 @@ static void map_debug_areas(void)
 
 void ibm_fsp_init(void)
 {
+	int ph;
+
 	/* Early initializations of the FSP interface */
+	ph = boot_timeline_start("fsp-init", BOOT_EVENT_NO_ID);
 	fsp_init();
 	map_debug_areas();
 	fsp_sysparam_init();
@@ -85,6 +89,7 @@ void ibm_fsp_init(void)
 	/* Get ready to receive E0 class messages. We need to respond
 	 * to some of these for the init sequence to make forward progress
 	 */
+	ph = boot_timeline_next(ph, "fsp-preinit");
 	fsp_console_preinit();
 
 	/* Get ready to receive OCC related messages */
@@ -101,43 +106,54 @@ void ibm_fsp_init(void)
 	fsp_dump_init();
 
 	/* Start FSP/HV state controller & perform OPL */
+	ph = boot_timeline_next(ph, "fsp-opl");
 	fsp_opl();
 
 	/* Send MDST table notification to FSP */
+	ph = boot_timeline_next(ph, "fsp-mdst");
 	op_display(OP_LOG, OP_MOD_INIT, 0x0000);
 	fsp_mdst_table_init();
 
 	/* Initialize the panel */
+	ph = boot_timeline_next(ph, "fsp-panel");
 	op_display(OP_LOG, OP_MOD_INIT, 0x0001);
 	fsp_oppanel_init();
 
 	/* Start the surveillance process */
+	ph = boot_timeline_next(ph, "fsp-surv");
 	op_display(OP_LOG, OP_MOD_INIT, 0x0002);
 	fsp_init_surveillance();
 
 	/* Initialize sensor access */
+	ph = boot_timeline_next(ph, "fsp-sensors");
 	op_display(OP_LOG, OP_MOD_INIT, 0x0003);
 	fsp_init_sensor();
 
 	/* LED */
+	ph = boot_timeline_next(ph, "fsp-leds");
 	op_display(OP_LOG, OP_MOD_INIT, 0x0004);
 	fsp_led_init();
 
 	/* Monitor for DIAG events */
+	ph = boot_timeline_next(ph, "fsp-diag");
 	op_display(OP_LOG, OP_MOD_INIT, 0x0005);
 	fsp_init_diag();
 
 	/* Finish initializing the console */
+	ph = boot_timeline_next(ph, "fsp-console");
 	op_display(OP_LOG, OP_MOD_INIT, 0x0006);
 	fsp_console_init();
 
 	/* Read our initial RTC value */
+	ph = boot_timeline_next(ph, "fsp-rtc");
 	op_display(OP_LOG, OP_MOD_INIT, 0x0008);
 	fsp_rtc_init();
 
 	/* Initialize code update access */
+	ph = boot_timeline_next(ph, "fsp-code-update");
 	op_display(OP_LOG, OP_MOD_INIT, 0x0009);
 	fsp_code_update_init();
+	boot_timeline_end(ph);
 
 	/* Setup console */
 	if (fsp_present())